@@ -0,0 +1,100 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * High-resolution clocksource (TSC calibrated against the PIT)
+ */
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#define CLOCK_NS_PER_SEC 1000000000
+
+// Shared time page, mapped read-only into every user process after the
+// system call ring page (second page of the user region)
+#define CLOCK_PAGE_ADDR 0xc0001000
+
+#ifndef ASSEMBLER
+
+// Shared time page
+// Updated by the kernel on every timer tick. Readers retry while seq is
+// odd (update in progress) or changes while they read (seqlock)
+typedef struct clock_page_t {
+    volatile unsigned int seq;          // Sequence counter
+    volatile int ticks;                 // Timer ticks (timer_get_system_time())
+    volatile unsigned long long tick_cycles; // Cycle count at the last update
+    volatile unsigned int tick_hz;      // Timer ticks per second
+    volatile unsigned int khz;          // TSC frequency, 0 if not calibrated
+    volatile unsigned int mult;         // ns = (cycles * mult) >> shift
+    volatile unsigned int shift;
+    volatile unsigned long long boot_cycles; // Cycle count at time 0
+} clock_page_t;
+
+// Shared time page (kernel address), NULL until clock_page_init()
+extern clock_page_t *clock_page;
+
+/**
+ * Calibrates the time stamp counter against the PIT
+ * Must be called with interrupts disabled
+ */
+void clock_init(void);
+
+/**
+ * Allocates the shared time page and fills in the calibration values
+ * Must be called after clock_init() and frame_init()
+ */
+void clock_page_init(void);
+
+/**
+ * Publishes the current tick count in the shared time page
+ * Called by the timer on every tick (and after a tickless period)
+ */
+void clock_page_update(void);
+
+/**
+ * Returns the current value of the time stamp counter
+ * @return CPU cycle count
+ */
+unsigned long long clock_get_cycles(void);
+
+/**
+ * Returns the monotonic time since the clock was initialized
+ * @return time in nanoseconds
+ */
+unsigned long long clock_get_ns(void);
+
+/**
+ * Converts a cycle count (or difference) to nanoseconds
+ * @param cycles - number of CPU cycles
+ * @return nanoseconds
+ */
+unsigned long long clock_cycles_to_ns(unsigned long long cycles);
+
+/**
+ * Returns the calibrated time stamp counter frequency
+ * @return frequency in kHz, 0 if the TSC could not be calibrated
+ */
+unsigned int clock_get_khz(void);
+
+/**
+ * Divides a 64-bit value by a 32-bit value without needing libgcc
+ * @param n - dividend
+ * @param d - divisor
+ * @param rem - pointer to where the remainder will be saved (may be NULL)
+ * @return quotient
+ */
+static inline unsigned long long clock_div64(unsigned long long n, unsigned int d, unsigned int *rem) {
+    unsigned int high = n >> 32;
+    unsigned int q_high = high / d;
+    unsigned int q_low;
+    unsigned int r = high % d;
+
+    asm("divl %4" : "=a"(q_low), "=d"(r) : "a"((unsigned int)n), "d"(r), "rm"(d));
+    if(rem) {
+        *rem = r;
+    }
+    return ((unsigned long long)q_high << 32) | q_low;
+}
+
+#endif
+#endif
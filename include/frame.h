@@ -0,0 +1,95 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Physical page frame allocator
+ */
+#ifndef FRAME_H
+#define FRAME_H
+
+// Largest block order; blocks hold 1 << order contiguous frames
+#define FRAME_MAX_ORDER     10
+#define FRAME_ORDERS        (FRAME_MAX_ORDER + 1)
+
+// Highest physical address managed (the top of the address space is
+// reserved for devices)
+#define FRAME_MEMORY_MAX_KB (3 * 1024 * 1024)
+
+// Memory assumed to be installed if the CMOS reports none
+#define FRAME_MEMORY_DEFAULT_KB (32 * 1024)
+
+/**
+ * Discovers the installed memory and adds every frame after the
+ * kernel image to the allocator
+ */
+void frame_init(void);
+
+/**
+ * Allocates a block of contiguous page frames
+ * Must be called with interrupts disabled
+ * @param order - block order (the block holds 1 << order frames)
+ * @return physical address of the block (page aligned), NULL if out of memory
+ */
+void *frame_alloc(int order);
+
+/**
+ * Frees a block of page frames, merging it with its free buddies
+ * Must be called with interrupts disabled
+ * @param addr - physical address returned by frame_alloc
+ */
+void frame_free(void *addr);
+
+/**
+ * Adds a reference to an allocated block
+ * Blocks start out with one reference when allocated
+ * Must be called with interrupts disabled
+ * @param addr - physical address returned by frame_alloc
+ */
+void frame_get(void *addr);
+
+/**
+ * Drops a reference to an allocated block, freeing it with the last one
+ * Must be called with interrupts disabled
+ * @param addr - physical address returned by frame_alloc
+ */
+void frame_put(void *addr);
+
+/**
+ * Gets the number of references to an allocated block
+ * @param addr - physical address returned by frame_alloc
+ * @return reference count
+ */
+int frame_refcount(void *addr);
+
+/**
+ * Finds the smallest block order that holds a number of bytes
+ * @param size - number of bytes
+ * @return block order, -1 if the size is larger than the largest block
+ */
+int frame_order(int size);
+
+/**
+ * Gets the end of physical memory
+ * @return physical address after the last usable frame
+ */
+unsigned int frame_memory_top(void);
+
+/**
+ * Gets the number of free page frames
+ * @return number of free frames
+ */
+int frame_free_count(void);
+
+/**
+ * Gets the fragmentation of free memory
+ * @return percentage of free memory that is not in the largest free block
+ */
+int frame_fragmentation(void);
+
+/**
+ * Logs the free block counts for each order and the fragmentation
+ */
+void frame_stats(void);
+
+#endif
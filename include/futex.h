@@ -0,0 +1,50 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Futexes (wait/wake on memory words)
+ */
+#ifndef FUTEX_H
+#define FUTEX_H
+
+// Number of wait queues in the futex hash table (power of two)
+#ifndef FUTEX_HASH_BITS
+#define FUTEX_HASH_BITS 6
+#endif
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+/**
+ * A futex is any aligned word of process memory. Waiters are keyed by
+ * the physical address of the word, so every mapping of the same frame
+ * refers to the same futex. Processes only enter the kernel to block
+ * or to wake waiters; the value of the word is managed in user space.
+ */
+
+/**
+ * Initializes the futex hash table
+ */
+void futex_init(void);
+
+/**
+ * Blocks the current process if a word still holds an expected value
+ * Must be called from a system call: the process is switched out when
+ * the system call returns, and the result of the system call is
+ * replaced with -1 if the timeout expires first
+ * @param addr - address of the word (in the current address space)
+ * @param expected - value the word must hold for the process to block
+ * @param ms - timeout in milliseconds, 0 to wait forever
+ * @return 0 if the process blocked, -1 if the word changed or the
+ *         address is invalid
+ */
+int futex_wait(unsigned int addr, unsigned int expected, int ms);
+
+/**
+ * Wakes processes waiting on a word
+ * @param addr - address of the word (in the current address space)
+ * @param count - maximum number of processes to wake
+ * @return number of processes woken, -1 if the address is invalid
+ */
+int futex_wake(unsigned int addr, int count);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Global descriptor table and task state segments
+ */
+#ifndef GDT_H
+#define GDT_H
+
+// Segment selectors (KCODE_SEG and KDATA_SEG are defined in kernel.h)
+// sysenter/sysexit require the user segments to directly follow the
+// kernel ones
+#define GDT_UCODE_SEG       0x18    // Ring 3 code
+#define GDT_UDATA_SEG       0x20    // Ring 3 data/stack
+#define GDT_TSS_SEG         0x28    // Main task (everything but fault handling)
+#define GDT_FAULT_TSS_SEG   0x30    // Page fault task
+#define GDT_ENTRIES         7
+
+// Selectors loaded by ring 3 code (with the requested privilege level)
+#define UCODE_SEL           (GDT_UCODE_SEG | 3)
+#define UDATA_SEL           (GDT_UDATA_SEG | 3)
+
+// Offsets of the ring 0 stack and CR3 fields in a task state segment
+#define TSS_ESP0            4
+#define TSS_CR3             28
+
+#ifndef ASSEMBLER
+
+// Task state segment
+typedef struct tss_t {
+    unsigned short link;    // Selector of the task to return to
+    unsigned short _notlink;
+    unsigned int esp0;      // Stack for entering ring 0
+    unsigned short ss0;
+    unsigned short _notss0;
+    unsigned int esp1;
+    unsigned short ss1;
+    unsigned short _notss1;
+    unsigned int esp2;
+    unsigned short ss2;
+    unsigned short _notss2;
+    unsigned int cr3;       // Page directory (loaded, never saved, on a task switch)
+    unsigned int eip;
+    unsigned int eflags;
+    unsigned int eax;
+    unsigned int ecx;
+    unsigned int edx;
+    unsigned int ebx;
+    unsigned int esp;
+    unsigned int ebp;
+    unsigned int esi;
+    unsigned int edi;
+    unsigned short es;
+    unsigned short _notes;
+    unsigned short cs;
+    unsigned short _notcs;
+    unsigned short ss;
+    unsigned short _notss;
+    unsigned short ds;
+    unsigned short _notds;
+    unsigned short fs;
+    unsigned short _notfs;
+    unsigned short gs;
+    unsigned short _notgs;
+    unsigned short ldt;
+    unsigned short _notldt;
+    unsigned short trap;
+    unsigned short iomap;   // Offset of the I/O permission bitmap
+} tss_t;
+
+// Main task state segment
+extern tss_t tss;
+
+/**
+ * Loads the kernel GDT (flat code and data segments plus the task
+ * state segments) and the main task register
+ */
+void gdt_init(void);
+
+/**
+ * Installs a task state segment descriptor
+ * @param selector - segment selector for the descriptor
+ * @param task - pointer to the task state segment
+ */
+void gdt_set_tss(int selector, tss_t *task);
+
+#endif
+#endif
@@ -16,6 +16,7 @@
 #endif
 
 // ISR definitions
+#define IRQ_PAGE_FAULT 0x0e    // Page fault exception
 #define IRQ_TIMER    0x20      // PIC IRQ 0 (Timer)
 #define IRQ_KEYBOARD 0x21      // PIC IRQ 1 (Keyboard)
 
@@ -49,6 +50,18 @@ void interrupts_enable(void);
  */
 void interrupts_disable(void);
 
+/**
+ * Disables interrupts with the CPU, saving the previous state
+ * @return previous EFLAGS value (for interrupts_restore)
+ */
+int interrupts_save(void);
+
+/**
+ * Restores the interrupt state saved by interrupts_save
+ * @param flags - value returned by interrupts_save
+ */
+void interrupts_restore(int flags);
+
 /**
  * Registers an ISR in the IDT and IRQ handler for processing interrupts
  * @param irq - IRQ number
@@ -57,6 +70,22 @@ void interrupts_disable(void);
  */
 void interrupts_irq_register(int irq, irq_handler_t entry, irq_handler_t handler);
 
+/**
+ * Registers an interrupt gate that ring 3 code may invoke with the
+ * int instruction (for system calls)
+ * @param irq - interrupt number
+ * @param entry - the function to run when the interrupt occurs
+ */
+void interrupts_user_gate_register(int irq, irq_handler_t entry);
+
+/**
+ * Registers a task gate for the specified interrupt
+ * The interrupt is handled by switching to the given task
+ * @param irq - interrupt number
+ * @param selector - segment selector of the task state segment
+ */
+void interrupts_task_gate_register(int irq, int selector);
+
 /**
  * Interrupt service routine handler
  * @param irq - IRQ number
@@ -0,0 +1,111 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Message passing between processes
+ */
+#ifndef IPC_H
+#define IPC_H
+
+#include "kproc.h"
+
+/**
+ * Messages are passed synchronously: the sender blocks in the mailbox
+ * of the receiver (a queue of waiting senders) until the receiver takes
+ * the message, so nothing is buffered in the kernel. A message is made
+ * of IPC_MSG_WORDS words, copied straight from the trapframe of the
+ * sender to the trapframe of the receiver, and optionally one page that
+ * is moved from the IPC area of the sender to the IPC area of the
+ * receiver by remapping it.
+ *
+ * Registers (int 0x80 only):
+ *   eax      - system call number in, result out
+ *   ebx..edx - message words in and out
+ *   esi      - page address in (0 for none), received page address out
+ *   edi      - partner process id in
+ */
+
+// Number of words in a message
+#define IPC_MSG_WORDS 3
+
+// Pages that can be transferred live in the IPC area of the address
+// space; it is demand-zero, so touching a page there maps a new one.
+// It shares the first page table of the user region with the system
+// call ring and the time page
+#define IPC_AREA_ADDR   0xc0100000
+#define IPC_AREA_PAGES  64
+
+#ifndef ASSEMBLER
+
+// Message (as seen by user programs)
+typedef struct ipc_msg_t {
+    unsigned int word[IPC_MSG_WORDS];   // Message words (ebx, ecx, edx)
+    unsigned int page;                  // Page address (esi)
+} ipc_msg_t;
+
+// IPC operation a process is blocked in
+typedef enum ipc_state_t {
+    IPC_NONE,           // Not in an IPC operation
+    IPC_SEND,           // Waiting in a mailbox to send
+    IPC_CALL,           // Waiting in a mailbox to send, then for the reply
+    IPC_RECEIVE,        // Waiting for a message
+    IPC_REPLY_WAIT      // Message taken, waiting for the reply
+} ipc_state_t;
+
+/**
+ * send(dest)
+ * Sends a message, blocking until the destination takes it
+ * @param dest - process id of the receiver
+ * @return 0 if the message is taken or the process blocked, -1 on error
+ *         (the result becomes -1 if the message is refused later)
+ */
+int ipc_send(int dest);
+
+/**
+ * receive()
+ * Takes the next message from the mailbox, blocking until one arrives
+ * A page in the message is mapped at the page address passed in esi
+ * (messages with a page are refused if it is 0)
+ * @return process id of the sender (once a message is taken), -1 on error
+ */
+int ipc_receive(void);
+
+/**
+ * call(dest)
+ * Sends a message and waits for the reply from the destination
+ * The page address passed in esi is sent if it is mapped, and is where
+ * a page in the reply is mapped
+ * @param dest - process id of the receiver
+ * @return process id of the replier (once the reply arrives), -1 on error
+ */
+int ipc_call(int dest);
+
+/**
+ * reply(dest)
+ * Replies to a process waiting in call(); never blocks
+ * @param dest - process id of the caller
+ * @return 0 on success, -1 if the process is not waiting for a reply
+ *         from the current process, or refuses the page
+ */
+int ipc_reply(int dest);
+
+/**
+ * Fails the IPC operations of every process waiting on a process that
+ * is exiting
+ * Must be called with interrupts disabled
+ * @param proc - process entry
+ */
+void ipc_exit(proc_t *proc);
+
+/**
+ * Maps a new page into the IPC area of a process after a page fault
+ * @param proc - process entry
+ * @param addr - faulting address
+ * @return 0 on success, -1 if the address is outside the IPC area or
+ *         there is no memory
+ */
+int ipc_area_fault(proc_t *proc, unsigned int addr);
+
+#endif
+#endif
@@ -9,6 +9,7 @@
 #define KERNEL_H
 
 #define KSTACK_SIZE 16384
+#define PAGE_SIZE 4096
 #define KCODE_SEG 0x08
 #define KDATA_SEG 0x10
 
@@ -121,8 +122,10 @@ void kernel_context_enter(trapframe_t *trapframe);
 __BEGIN_DECLS
 /**
  * Exits the kernel context and restores the process context
+ * @param trapframe - process trapframe
+ * @param page_dir - process page directory (CR3 is only reloaded if it changes)
  */
-extern void kernel_context_exit();
+extern void kernel_context_exit(trapframe_t *trapframe, unsigned int *page_dir);
 __END_DECLS
 
 #endif
@@ -0,0 +1,62 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Kernel heap allocator
+ */
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+// Smallest and largest size classes (powers of two, including the
+// allocation header)
+#define KMALLOC_MIN_SHIFT   4
+#define KMALLOC_MAX_SHIFT   15
+#define KMALLOC_CLASSES     (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+// Usage statistics for a size class
+typedef struct kmalloc_stats_t {
+    int allocs;             // Number of successful allocations
+    int frees;              // Number of frees
+    int failed;             // Number of allocations that ran out of memory
+    int inuse;              // Allocations currently in use
+    int peak;               // Largest number of allocations in use at once
+    int requested;          // Bytes requested by the allocations in use
+} kmalloc_stats_t;
+
+/**
+ * Initializes the kernel heap
+ * Must be called after frame_init()
+ */
+void kmalloc_init(void);
+
+/**
+ * Allocates memory from the kernel heap
+ * The size is rounded up to a power of two size class; the memory is
+ * not initialized
+ * Must be called with interrupts disabled
+ * @param size - number of bytes
+ * @return pointer to the memory, NULL on error
+ */
+void *kmalloc(int size);
+
+/**
+ * Returns memory to the kernel heap
+ * Must be called with interrupts disabled
+ * @param ptr - pointer returned by kmalloc (NULL is ignored)
+ */
+void kfree(void *ptr);
+
+/**
+ * Gets the usage statistics for a size class
+ * @param class - size class (0 to KMALLOC_CLASSES-1)
+ * @return pointer to the statistics, NULL if the class is invalid
+ */
+kmalloc_stats_t *kmalloc_get_stats(int class);
+
+/**
+ * Logs the usage statistics of every size class that has been used
+ */
+void kmalloc_stats(void);
+
+#endif
@@ -9,13 +9,41 @@
 #define KPROC_H
 
 #include "trapframe.h"
+#include "paging.h"
 
 #ifndef PROC_MAX
-#define PROC_MAX        10   // maximum number of processes to support
+#define PROC_MAX        1024 // maximum number of processes to support
 #endif
 
 #define PROC_NAME_LEN   32   // Maximum length of a process name
-#define PROC_STACK_SIZE 8192 // Process stack size
+#define PROC_STACK_SIZE 8192 // Default process stack size
+#define PROC_STACK_MIN  1024 // Smallest process stack size
+#define PROC_STACK_MAX  65536 // Largest process stack size
+#define PROC_STACK_POOL 8    // Pre-zeroed stacks kept ready for each stack size
+#define PROC_REAP_BATCH 16   // Zombies released by the reaper per batch
+
+// User process stacks live at the top of the per-process address space;
+// only the top page is mapped up front, the rest is mapped on demand
+// down to the stack size limit. The page below the limit stays unmapped
+// as a guard page
+#define PROC_USTACK_TOP PAGING_USER_END
+
+// Stack overflow detection
+// Canary words are written at the base of each stack and checked on
+// every context switch
+#define PROC_STACK_CANARY       0x57ac4ca7
+#define PROC_STACK_CANARY_WORDS 4
+
+// Process ids are made up of the process table entry (slot) in the low
+// bits and a generation counter, bumped every time the entry is freed,
+// in the high bits. A stale pid therefore never matches a reused entry.
+#define PROC_PID_SLOT_BITS  16
+#define PROC_PID_SLOT_MASK  ((1 << PROC_PID_SLOT_BITS) - 1)
+#define PROC_PID_GEN_MASK   0x7fff
+
+#if PROC_MAX > (1 << PROC_PID_SLOT_BITS)
+#error "PROC_MAX exceeds the number of slots a pid can encode"
+#endif
 
 
 // Process types
@@ -30,16 +58,29 @@ typedef enum proc_type_t {
 typedef enum state_t {
     NONE,               // Process has no state (doesn't exist)
     IDLE,               // Process is idle (not scheduled)
-    RUNNING             // Process is running (scheduled)
+    RUNNING,            // Process is running (scheduled)
+    BLOCKED,            // Process is waiting for an event (not schedulable)
+    ZOMBIE              // Process has exited and is waiting to be reaped
 } state_t;
 
 
 // Process control block
 // Contains all details to describe a process
-typedef struct proc_t {
+typedef struct proc_t proc_t;
+
+// Intrusive queue of processes, linked through the process control blocks
+typedef struct proc_queue_t {
+    proc_t *head;             // First process in the queue
+    proc_t *tail;             // Last process in the queue
+    int size;                 // Number of processes in the queue
+} proc_queue_t;
+
+struct proc_t {
     int pid;                  // Process id
     state_t state;            // Process state
     proc_type_t type;         // Process type (kernel or user)
+    int priority;             // Scheduling priority (0 is the highest)
+    int base_priority;        // Priority restored on an MLFQ boost
 
     char name[PROC_NAME_LEN]; // Process name
 
@@ -48,8 +89,26 @@ typedef struct proc_t {
     int cpu_time;             // Current CPU time the process has used
 
     unsigned char *stack;     // Pointer to the process stack
+    int stack_size;           // Size of the process stack
+    int stack_peak;           // Deepest stack usage seen so far (bytes)
+    int stack_pages;          // Stack pages mapped (user processes)
     trapframe_t *trapframe;   // Pointer to the trapframe
-} proc_t;
+    trapframe_t user_frame;   // Saved ring 3 state (user processes)
+    pde_t *page_dir;          // Page directory of the process address space
+    struct syscall_ring_t *ring; // Shared system call ring (kernel address), NULL if none
+    int ring_timers;          // Ring timer requests still pending
+    unsigned int futex_key;   // Futex the process waits on (physical address)
+    int futex_timer;          // Timer id of the futex wait timeout, -1 if none
+
+    int ipc_state;            // IPC operation the process is blocked in (ipc_state_t)
+    unsigned int ipc_window;  // Where a received page is mapped, 0 if pages are refused
+    proc_queue_t ipc_senders; // Mailbox: processes waiting to send to this process
+    proc_queue_t ipc_callers; // Processes waiting for a reply from this process
+
+    proc_queue_t *queue;      // Queue the process is linked into (NULL if none)
+    proc_t *next;             // Next process in the queue
+    proc_t *prev;             // Previous process in the queue
+};
 
 
 /**
@@ -69,23 +128,118 @@ void kproc_init(void);
  * @param proc_ptr - address of process to execute
  * @param proc_name - "friendly" process name
  * @param proc_type - process type (kernel or user)
+ * @param stack_size - stack size in bytes (rounded up to a power of two
+ *                     between PROC_STACK_MIN and PROC_STACK_MAX), or 0
+ *                     for PROC_STACK_SIZE
  * @return process id of the created process, -1 on error
  */
-int kproc_create(void *proc_ptr, char *proc_name, proc_type_t proc_type);
+int kproc_create(void *proc_ptr, char *proc_name, proc_type_t proc_type, int stack_size);
+
+/**
+ * Performs one step of background stack maintenance: zeroes one freed
+ * stack, or tops up the pool of pre-zeroed default size stacks
+ * Called by the idle task with interrupts enabled
+ * @return 1 if work was done, 0 if there is nothing left to do
+ */
+int kproc_stack_refill(void);
+
+/**
+ * Clones a user process
+ * The clone gets a copy on write duplicate of the address space and
+ * resumes from the same saved state as the original
+ * @param proc - process entry of the user process to clone
+ * @return process id of the clone, -1 on error
+ */
+int kproc_clone(proc_t *proc);
+
+/**
+ * Checks the canary words at the base of a process stack
+ * @param proc - process entry
+ * @return 0 if the canary is intact, -1 if the stack overflowed
+ */
+int kproc_stack_check(proc_t *proc);
+
+/**
+ * Maps a new page into a user process stack after a page fault
+ * @param proc - process entry
+ * @param addr - faulting address
+ * @return 0 on success, -1 if the address is outside the stack limit
+ *         or there is no memory
+ */
+int kproc_stack_grow(proc_t *proc, unsigned int addr);
+
+/**
+ * Updates and returns the stack high-water mark of a process
+ * Only the part of the stack below the previous mark is scanned
+ * @param proc - process entry
+ * @return deepest stack usage seen so far (bytes)
+ */
+int kproc_stack_usage(proc_t *proc);
 
 /**
  * Destroys a process
- * If the process is currently scheduled it must be unscheduled
+ * The process is unscheduled immediately; its process table entry
+ * and stack are released later by the reaper process
  * @param proc - process entry
  * @return 0 on success, -1 on error
  */
 int kproc_destroy(proc_t *proc);
 
+/**
+ * Turns the current process into a zombie
+ * The process is switched out the next time the scheduler runs
+ * Must be called with interrupts disabled
+ */
+void kproc_exit_current(void);
+
+/**
+ * Exit trampoline
+ * Every process returns here when its entry function returns. The
+ * process becomes a zombie and never runs again
+ */
+void kproc_exit(void);
+
 /**
  * Looks up a process in the process table via the process id
+ * Runs in constant time; stale pids of freed processes are rejected
  * @param pid - process id
  * @return pointer to the process entry, NULL or error or if not found
  */
 proc_t *pid_to_proc(int pid);
 
+/**
+ * Initializes a process queue
+ * @param queue - pointer to the process queue
+ */
+void proc_queue_init(proc_queue_t *queue);
+
+/**
+ * Adds a process to the tail of a process queue
+ * @param queue - pointer to the process queue
+ * @param proc - process entry (must not be in another queue)
+ * @return 0 on success, -1 on error
+ */
+int proc_queue_in(proc_queue_t *queue, proc_t *proc);
+
+/**
+ * Removes the process at the head of a process queue
+ * @param queue - pointer to the process queue
+ * @return pointer to the process entry, NULL if the queue is empty
+ */
+proc_t *proc_queue_out(proc_queue_t *queue);
+
+/**
+ * Removes a process from anywhere in the process queue
+ * @param queue - pointer to the process queue
+ * @param proc - process entry
+ * @return 0 on success, -1 if the process is not in the queue
+ */
+int proc_queue_remove(proc_queue_t *queue, proc_t *proc);
+
+/**
+ * Determines if a process queue is empty
+ * @return 1 if true, 0 if false
+ */
+#define proc_queue_is_empty(queue) ((queue) && (queue)->size == 0)
+
 #endif
@@ -0,0 +1,146 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Paging and address spaces
+ */
+#ifndef PAGING_H
+#define PAGING_H
+
+// Page directory/table entry flags
+#define PAGING_PRESENT      0x001   // Mapping is valid
+#define PAGING_WRITE        0x002   // Mapping is writable
+#define PAGING_USER         0x004   // Mapping is accessible from ring 3
+#define PAGING_LARGE        0x080   // Directory entry maps a 4MB page
+#define PAGING_GLOBAL       0x100   // Mapping is kept in the TLB across CR3 loads
+#define PAGING_OWNED        0x200   // Frame belongs to the address space (software bit)
+#define PAGING_COW          0x400   // Write access is restored by copying (software bit)
+#define PAGING_FLAGS_MASK   0xfff
+
+// Page fault error code bits
+#define PAGING_FAULT_PRESENT 0x1    // Page was present (protection violation)
+#define PAGING_FAULT_WRITE   0x2    // Fault was caused by a write
+#define PAGING_FAULT_USER    0x4    // Fault happened in ring 3
+#define PAGING_ADDR_MASK    0xfffff000
+
+#define PAGING_ENTRIES      1024
+#define PAGING_LARGE_SIZE   0x400000
+
+// Per-process part of the address space; everything below is the
+// kernel identity mapping of physical memory, shared by every process
+#define PAGING_USER_BASE    0xc0000000
+#define PAGING_USER_END     0xffc00000
+
+#ifndef ASSEMBLER
+
+typedef unsigned int pde_t;     // Page directory entry
+typedef unsigned int pte_t;     // Page table entry
+
+// Kernel page directory (used by kernel processes)
+extern pde_t *paging_kernel_dir;
+
+/**
+ * Builds the kernel identity mapping of physical memory with global
+ * 4MB pages, enables paging and installs the page fault task
+ * Must be called after frame_init() and gdt_init()
+ */
+void paging_init(void);
+
+/**
+ * Creates a new address space
+ * The kernel mappings are shared; the user region starts out empty
+ * @return page directory, NULL if out of memory
+ */
+pde_t *paging_dir_create(void);
+
+/**
+ * Destroys an address space
+ * Frees the page tables of the user region and drops the references
+ * to every frame mapped with PAGING_OWNED
+ * @param dir - page directory (must not be the kernel page directory)
+ */
+void paging_dir_destroy(pde_t *dir);
+
+/**
+ * Duplicates an address space using copy on write
+ * Owned pages are shared read-only between both address spaces and
+ * copied on the first write; other pages are shared as they are
+ * @param dir - page directory to duplicate
+ * @return new page directory, NULL if out of memory
+ */
+pde_t *paging_dir_clone(pde_t *dir);
+
+/**
+ * Resolves a write fault on a copy on write page
+ * The page gets a private copy of the frame, or simply becomes
+ * writable again if no other address space shares the frame
+ * @param dir - page directory
+ * @param vaddr - faulting virtual address
+ * @return 0 on success, -1 if the page is not copy on write or there is no memory
+ */
+int paging_cow_fault(pde_t *dir, unsigned int vaddr);
+
+/**
+ * Maps a page in the user region of an address space
+ * @param dir - page directory
+ * @param vaddr - virtual address (page aligned)
+ * @param paddr - physical address (page aligned)
+ * @param flags - PAGING_* flags (PAGING_PRESENT is implied)
+ * @return 0 on success, -1 on error
+ */
+int paging_map(pde_t *dir, unsigned int vaddr, unsigned int paddr, int flags);
+
+/**
+ * Removes a page mapping from the user region of an address space
+ * The frame itself is not freed
+ * @param dir - page directory
+ * @param vaddr - virtual address (page aligned)
+ * @return page table entry that was removed, 0 if nothing was mapped
+ */
+pte_t paging_unmap(pde_t *dir, unsigned int vaddr);
+
+/**
+ * Looks up the page table entry for a virtual address
+ * @param dir - page directory
+ * @param vaddr - virtual address in the user region
+ * @return pointer to the page table entry, NULL if there is no page table
+ */
+pte_t *paging_get_pte(pde_t *dir, unsigned int vaddr);
+
+/**
+ * Checks that a buffer is accessible from ring 3 in an address space
+ * Every page of the buffer must be present and mapped for user access
+ * @param dir - page directory
+ * @param vaddr - start of the buffer
+ * @param len - length of the buffer (bytes)
+ * @return 1 if the whole buffer is accessible, 0 otherwise
+ */
+int paging_user_access(pde_t *dir, unsigned int vaddr, unsigned int len);
+
+/**
+ * Page fault handler
+ * Runs as the page fault task with the kernel address space loaded
+ * @param error - page fault error code
+ */
+void paging_fault_handler(int error);
+
+/**
+ * Invalidates the TLB entry for a page in the loaded address space
+ * @param vaddr - virtual address
+ */
+static inline void paging_invalidate(unsigned int vaddr) {
+    asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+}
+
+/**
+ * Invalidates every non-global TLB entry (the whole user region)
+ */
+static inline void paging_flush(void) {
+    unsigned int cr3;
+    asm volatile("movl %%cr3, %0\n"
+                 "movl %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+#endif
+#endif
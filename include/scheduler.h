@@ -14,6 +14,32 @@
 #define SCHEDULER_TIMESLICE 250
 #endif
 
+// Number of priority levels (0 is the highest priority)
+#ifndef SCHEDULER_PRIO_LEVELS
+#define SCHEDULER_PRIO_LEVELS 8
+#endif
+
+// Priority assigned to newly created processes
+#ifndef SCHEDULER_PRIO_DEFAULT
+#define SCHEDULER_PRIO_DEFAULT (SCHEDULER_PRIO_LEVELS / 2)
+#endif
+
+// Multi-level feedback queue policy (1 = enabled, 0 = static priorities)
+#ifndef SCHEDULER_MLFQ
+#define SCHEDULER_MLFQ 1
+#endif
+
+// MLFQ quantum at the highest priority level, doubled for each level
+// below it and capped at SCHEDULER_TIMESLICE
+#ifndef SCHEDULER_QUANTUM_BASE
+#define SCHEDULER_QUANTUM_BASE 10
+#endif
+
+// Number of ticks between MLFQ priority boosts
+#ifndef SCHEDULER_BOOST_INTERVAL
+#define SCHEDULER_BOOST_INTERVAL 1000
+#endif
+
 
 /**
  * Initializes the scheduler
@@ -25,6 +51,23 @@ void scheduler_init();
  */
 void scheduler_run();
 
+/**
+ * Gives up the rest of the current process' quantum
+ * The process goes to the back of its run queue the next time the
+ * scheduler runs (without an MLFQ demotion)
+ */
+void scheduler_yield(void);
+
+/**
+ * Switches away from the current kernel process right away
+ * The caller sets the state of the process first (BLOCKED or ZOMBIE);
+ * a yield system call enters the kernel, and scheduler_run() does not
+ * keep a process in either state. Returns once the process runs again
+ * Must be called with interrupts disabled; returns with interrupts
+ * disabled
+ */
+void scheduler_switch(void);
+
 /**
  * Adds a process to the scheduler
  * @param proc - pointer to the process entry
@@ -37,4 +80,26 @@ void scheduler_add(proc_t *proc);
  */
 void scheduler_remove(proc_t *proc);
 
+/**
+ * Makes a blocked process runnable again
+ *
+ * A process blocks itself by setting its state to BLOCKED (with
+ * interrupts disabled): system calls are switched out at the end of
+ * the kernel entry, kernel processes call scheduler_switch(). A ZOMBIE
+ * process is switched out the same way but can no longer be woken.
+ * @param proc - pointer to the process entry
+ */
+void scheduler_wake(proc_t *proc);
+
+/**
+ * Changes the priority of a process
+ * If the process is waiting in the run queue it is moved to the
+ * run queue for the new priority level. The new priority also becomes
+ * the level the process returns to on an MLFQ boost.
+ * @param proc - pointer to the process entry
+ * @param priority - new priority (0 to SCHEDULER_PRIO_LEVELS-1)
+ * @return 0 on success, -1 on error
+ */
+int scheduler_set_priority(proc_t *proc, int priority);
+
 #endif
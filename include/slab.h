@@ -0,0 +1,52 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Slab object allocator
+ */
+#ifndef SLAB_H
+#define SLAB_H
+
+// Object alignment within a slab
+#define SLAB_ALIGN 8
+
+// Object cache
+// Holds free objects of a single size; grows by one slab at a time
+typedef struct slab_cache_t {
+    char *name;             // Cache name (for statistics)
+    int obj_size;           // Object size (rounded up to SLAB_ALIGN)
+    int slab_size;          // Bytes allocated each time the cache grows
+    int slab_order;         // Page frame block order of each slab
+    void *free;             // Free objects, linked through their first word
+    int slabs;              // Number of slabs allocated
+    int total;              // Number of objects carved from the slabs
+    int inuse;              // Number of objects allocated
+} slab_cache_t;
+
+/**
+ * Initializes an object cache
+ * No memory is allocated until the first object is requested
+ * @param cache - pointer to the cache
+ * @param name - cache name
+ * @param obj_size - size of each object
+ * @return 0 on success, -1 on error
+ */
+int slab_cache_init(slab_cache_t *cache, char *name, int obj_size);
+
+/**
+ * Allocates an object from a cache, growing the cache if needed
+ * The object contents are not initialized
+ * @param cache - pointer to the cache
+ * @return pointer to the object, NULL if out of memory
+ */
+void *slab_alloc(slab_cache_t *cache);
+
+/**
+ * Returns an object to its cache
+ * @param cache - pointer to the cache the object was allocated from
+ * @param obj - pointer to the object
+ */
+void slab_free(slab_cache_t *cache, void *obj);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Semaphores and mutexes
+ */
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "kproc.h"
+
+/**
+ * Waiting processes are BLOCKED and linked into the wait queue of the
+ * object, so they use no CPU time. Releasing the object hands it
+ * directly to the first waiter (first come, first served) and wakes
+ * only that process.
+ *
+ * semaphore_wait() and mutex_lock() block the calling process, so they
+ * may only be called from kernel processes. The other functions may
+ * also be called with interrupts disabled (e.g. from interrupt context).
+ */
+
+// Counting semaphore
+typedef struct semaphore_t {
+    int count;                  // Available units
+    proc_queue_t waiters;       // Processes waiting for a unit
+} semaphore_t;
+
+// Mutex
+typedef struct mutex_t {
+    proc_t *owner;              // Process holding the mutex (NULL if free)
+    proc_queue_t waiters;       // Processes waiting for the mutex
+} mutex_t;
+
+/**
+ * Initializes a semaphore
+ * @param sem - semaphore
+ * @param count - initial number of units
+ */
+void semaphore_init(semaphore_t *sem, int count);
+
+/**
+ * Takes a unit, blocking until one is available
+ * @param sem - semaphore
+ */
+void semaphore_wait(semaphore_t *sem);
+
+/**
+ * Takes a unit if one is available
+ * @param sem - semaphore
+ * @return 0 on success, -1 if no unit is available
+ */
+int semaphore_trywait(semaphore_t *sem);
+
+/**
+ * Returns a unit, handing it to the first waiting process (if any)
+ * @param sem - semaphore
+ */
+void semaphore_post(semaphore_t *sem);
+
+/**
+ * Initializes a mutex (unlocked)
+ * @param mutex - mutex
+ */
+void mutex_init(mutex_t *mutex);
+
+/**
+ * Locks a mutex, blocking until it is free
+ * @param mutex - mutex (must not be held by the calling process)
+ * @return 0 on success, -1 if the calling process already holds it
+ */
+int mutex_lock(mutex_t *mutex);
+
+/**
+ * Locks a mutex if it is free
+ * @param mutex - mutex
+ * @return 0 on success, -1 if the mutex is held
+ */
+int mutex_trylock(mutex_t *mutex);
+
+/**
+ * Unlocks a mutex, handing it to the first waiting process (if any)
+ * @param mutex - mutex (must be held by the calling process)
+ * @return 0 on success, -1 if the calling process does not hold it
+ */
+int mutex_unlock(mutex_t *mutex);
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * System calls
+ */
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+// System call interrupt
+#define IRQ_SYSCALL     0x80
+
+// System call numbers (passed in eax; arguments in ebx, esi and edi;
+// the result is returned in eax). The same registers are used with
+// int and sysenter, which needs ecx and edx for the return esp and eip
+#define SYSCALL_WRITE   0       // write(fd, buf, len): bytes written
+#define SYSCALL_YIELD   1       // yield(): 0
+#define SYSCALL_SLEEP   2       // sleep(ms): 0
+#define SYSCALL_GETPID  3       // getpid(): process id
+#define SYSCALL_EXIT    4       // exit(): does not return
+#define SYSCALL_RING_SETUP 5    // ring_setup(): address of the ring page
+#define SYSCALL_RING_ENTER 6    // ring_enter(): requests handled
+#define SYSCALL_TIMER   7       // timer(ms, user_data): 0, completion posted on expiry
+#define SYSCALL_FUTEX_WAIT 8    // futex_wait(addr, expected, ms): 0 when woken, -1 on timeout or mismatch
+#define SYSCALL_FUTEX_WAKE 9    // futex_wake(addr, count): processes woken
+#define SYSCALL_IPC_SEND   10   // send(dest) (message in registers, see ipc.h): 0
+#define SYSCALL_IPC_RECV   11   // receive(): sender pid
+#define SYSCALL_IPC_CALL   12   // call(dest): replier pid
+#define SYSCALL_IPC_REPLY  13   // reply(dest): 0
+#define SYSCALL_CLONE      14   // clone(): clone pid in the original, 0 in the clone
+#define SYSCALL_MAX     15
+
+// System call flags
+#define SYSCALL_FLAG_FAST 0x01  // Available through sysenter
+#define SYSCALL_FLAG_RING 0x02  // Available through the submission ring
+
+// Submission/completion rings
+// A user process may map one page shared with the kernel, holding a
+// ring of requests (submission queue) and a ring of results
+// (completion queue). The process owns sq_tail and cq_head, the kernel
+// owns sq_head and cq_tail. Indices run freely and are masked with
+// SYSCALL_RING_ENTRIES - 1. The kernel drains the submission queue on
+// every entry while the process runs, or right away on ring_enter()
+#define SYSCALL_RING_ADDR    0xc0000000 // First page of the user region
+#define SYSCALL_RING_ENTRIES 64         // Entries in each ring (power of two)
+
+// Model specific registers for sysenter
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// File descriptor for the console
+#define SYSCALL_FD_STDOUT 1
+
+#ifndef ASSEMBLER
+#include "trapframe.h"
+
+// Submission queue entry
+typedef struct syscall_sqe_t {
+    unsigned int num;           // System call number
+    unsigned int arg1;          // First argument
+    unsigned int arg2;          // Second argument
+    unsigned int arg3;          // Third argument
+    unsigned int user_data;     // Copied to the completion
+} syscall_sqe_t;
+
+// Completion queue entry
+typedef struct syscall_cqe_t {
+    unsigned int user_data;     // Value from the request (or the timer)
+    int result;                 // System call result
+} syscall_cqe_t;
+
+// Shared ring page
+typedef struct syscall_ring_t {
+    volatile unsigned int sq_head;      // Next request the kernel handles
+    volatile unsigned int sq_tail;      // Next free request entry
+    volatile unsigned int cq_head;      // Next completion the process reads
+    volatile unsigned int cq_tail;      // Next free completion entry
+    volatile unsigned int cq_overflow;  // Timer completions dropped on a full queue
+    syscall_sqe_t sq[SYSCALL_RING_ENTRIES];
+    syscall_cqe_t cq[SYSCALL_RING_ENTRIES];
+} syscall_ring_t;
+
+typedef char syscall_ring_size_check[(sizeof(syscall_ring_t) <= 4096) ? 1 : -1];
+
+// System call handler; the return value is passed back in eax
+typedef int (*syscall_handler_t)(unsigned int arg1, unsigned int arg2, unsigned int arg3);
+
+/**
+ * Installs the system call gate and the sysenter entry point
+ */
+void syscall_init(void);
+
+/**
+ * Dispatches a system call for the current process
+ * @param trapframe - trapframe saved on entry
+ */
+void syscall_dispatch(trapframe_t *trapframe);
+
+/**
+ * Dispatches a system call made with sysenter
+ * Only system calls that never block or switch processes are
+ * available through sysenter; the others must use int
+ * @param num - system call number
+ * @param arg1 - first argument
+ * @param arg2 - second argument
+ * @param arg3 - third argument
+ * @return system call result, -1 if the call is not available
+ */
+int syscall_fast_dispatch(unsigned int num, unsigned int arg1, unsigned int arg2, unsigned int arg3);
+
+/**
+ * Handles the requests queued in the submission ring of the current
+ * process, as long as there is room for their completions
+ * Only system calls that never block or switch processes are
+ * available through the ring; the others complete with -1
+ * Must be called with interrupts disabled and the address space of the
+ * current process loaded
+ * @return number of requests handled
+ */
+int syscall_ring_drain(void);
+
+#endif
+#endif
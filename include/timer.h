@@ -9,9 +9,30 @@
 #define TIMER_H
 
 #ifndef TIMERS_MAX
-#define TIMERS_MAX 32
+#define TIMERS_MAX 128
 #endif
 
+// Timer interrupt frequency (ticks per second)
+#ifndef TIMER_HZ
+#define TIMER_HZ 100
+#endif
+
+// Stop the periodic tick while only the idle task is runnable (1 = enabled)
+#ifndef TIMER_TICKLESS
+#define TIMER_TICKLESS 1
+#endif
+
+// Timer flags
+#define TIMER_FLAG_DEFERRABLE 0x1   // Timer does not wake an idle CPU
+#define TIMER_FLAG_IRQ        0x2   // Callback runs in the timer IRQ
+
+/**
+ * Timer callbacks are run by the kernel worker process (workqueue.h)
+ * with interrupts enabled, unless TIMER_FLAG_IRQ is set. Callbacks that
+ * touch kernel data structures shared with interrupt handlers must
+ * disable interrupts while doing so.
+ */
+
 /**
  * Initializes timer related data structures and variables
  */
@@ -22,10 +43,35 @@ void timer_init(void);
  * @param func_ptr - function pointer to be called
  * @param interval - number of ticks before the callback is performed
  * @param repeat   - Indicate how many intervals to repeat (-1 should repeat forever)
+ * @param slack    - number of ticks the callback may be delayed by so that it
+ *                   can be batched with other timers (0 for none)
+ *
+ * @return the allocated timer id or -1 for errors
+ */
+int timer_callback_register(void (*func_ptr)(), int interval, int repeat, int slack);
+
+/**
+ * Registers a new callback that is passed an argument
+ * The callback always runs in the timer IRQ (TIMER_FLAG_IRQ)
+ * @param func_ptr - function pointer to be called
+ * @param arg      - argument passed to the function
+ * @param interval - number of ticks before the callback is performed
+ * @param repeat   - Indicate how many intervals to repeat (-1 should repeat forever)
+ * @param slack    - number of ticks the callback may be delayed by so that it
+ *                   can be batched with other timers (0 for none)
  *
  * @return the allocated timer id or -1 for errors
  */
-int timer_callback_register(void (*func_ptr)(), int interval, int repeat);
+int timer_callback_register_arg(void (*func_ptr)(void *), void *arg, int interval, int repeat, int slack);
+
+/**
+ * Sets the flags for a registered callback
+ * @param id - timer id
+ * @param flags - TIMER_FLAG_* values
+ *
+ * @return 0 on success, -1 on error
+ */
+int timer_callback_set_flags(int id, int flags);
 
 /**
  * Unregisters the specified callback
@@ -38,8 +84,39 @@ int timer_callback_unregister(int id);
 /**
  * Returns the current system time (in ticks)
  *
+ * The tick count wraps after 2^31 ticks; use clock_get_ns() (clock.h)
+ * for long-running or sub-tick measurements.
+ *
  * @return timer_ticks
  */
 int timer_get_system_time(void);
 
+/**
+ * Converts a time in milliseconds to timer ticks, rounding up
+ *
+ * The whole seconds are converted separately, so the result does not
+ * overflow for any non-negative number of milliseconds.
+ *
+ * @param ms - milliseconds (not negative)
+ * @return number of ticks
+ */
+int timer_ms_to_ticks(int ms);
+
+/**
+ * Stops the periodic tick until the next non-deferrable timer is due
+ *
+ * Called when the idle task is about to run. The timer is programmed
+ * in one-shot mode for the next deadline (limited by the timer hardware).
+ */
+void timer_tickless_enter(void);
+
+/**
+ * Restarts the periodic tick after a tickless period
+ *
+ * Catches up the system time for the ticks that were skipped. Must be
+ * called on every kernel entry before the interrupt is handled.
+ * @param irq - interrupt that caused the kernel entry
+ */
+void timer_tickless_exit(int irq);
+
 #endif
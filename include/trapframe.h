@@ -8,6 +8,13 @@
 #ifndef TRAPFRAME_H
 #define TRAPFRAME_H
 
+// Size of a full trapframe (saved from ring 3)
+#define TRAPFRAME_SIZE 72
+
+// Size of a trapframe saved from ring 0 (no stack switch, so user_esp
+// and user_ss are not pushed)
+#define TRAPFRAME_KERNEL_SIZE (TRAPFRAME_SIZE - 8)
+
 #ifndef ASSEMBLER
 
 // This structure corresponds to the state of user registers
@@ -46,7 +53,13 @@ typedef struct {
     unsigned int eip;
     unsigned int cs;
     unsigned int eflags;
+
+    // Ring 3 stack (only pushed when the interrupt came from ring 3)
+    unsigned int user_esp;
+    unsigned int user_ss;
 } trapframe_t;
 
+typedef char trapframe_size_check[(sizeof(trapframe_t) == TRAPFRAME_SIZE) ? 1 : -1];
+
 #endif
 #endif
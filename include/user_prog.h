@@ -8,6 +8,40 @@
 #ifndef USER_H
 #define USER_H
 
+// Number of system calls timed by the benchmark
+#define USER_BENCH_CALLS 10000
+
+// System call ring test: writes queued in one batch, and the timer
+// queued after them
+#define USER_RING_WRITES     4
+#define USER_RING_TIMER_MS   500
+#define USER_RING_TIMER_DATA 0x7153
+
+// User programs are linked into the kernel image but run in ring 3;
+// their code and constants go into these sections, which are the only
+// parts of the kernel image mapped (read only) for user access, each on
+// pages of its own. They must not call kernel functions (the system
+// call wrappers are inlined)
+#define USER_TEXT   __attribute__((section("user_text")))
+#define USER_RODATA __attribute__((section("user_rodata")))
+
+// Entry functions with this attribute take one argument in eax, which
+// the creator of the process sets in its trapframe
+#define USER_ENTRY_ARG __attribute__((regparm(1)))
+
+// Number of round trips timed by the IPC test
+#define USER_IPC_CALLS 1000
+
+// Section bounds (generated by the linker)
+extern char __start_user_text[], __stop_user_text[];
+extern char __start_user_rodata[], __stop_user_rodata[];
+
+/**
+ * Return address of every user program
+ * Ends the process with the exit system call
+ */
+void user_exit(void);
+
 /**
  * User test program
  * This "program" will test functionality that
@@ -15,4 +49,41 @@
  */
 void user_test(void);
 
+/**
+ * Short-lived user program
+ * Returns right away, exercising process exit and reaping
+ */
+void user_short(void);
+
+/**
+ * System call benchmark
+ * Measures the average round trip cost of a system call that does
+ * no work (getpid), through int and through sysenter, and the cost of
+ * reading the clock from the shared time page and of an uncontended
+ * user space mutex lock/unlock
+ */
+void user_syscall_bench(void);
+
+/**
+ * System call ring test
+ * Queues a batch of console writes and a timer in the shared ring,
+ * rings the doorbell once and waits for the timer to expire
+ */
+void user_ring_test(void);
+
+/**
+ * IPC echo server
+ * Replies to every message with the first word incremented, sending
+ * back any page it received
+ */
+void user_ipc_server(void);
+
+/**
+ * IPC client
+ * Times call/reply round trips with the echo server, then sends a
+ * page through it and prints what comes back
+ * @param server - process id of the echo server
+ */
+USER_ENTRY_ARG void user_ipc_client(int server);
+
 #endif
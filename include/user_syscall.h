@@ -0,0 +1,384 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * System call wrappers for user programs
+ *
+ * User programs run in ring 3 and can only reach their own sections
+ * of the kernel image (user_prog.h), so the wrappers are always inlined.
+ */
+#ifndef USER_SYSCALL_H
+#define USER_SYSCALL_H
+
+#include "syscall.h"
+#include "clock.h"
+#include "ipc.h"
+
+#define USER_INLINE static inline __attribute__((always_inline))
+
+/**
+ * Performs a system call through the int gate
+ * @param num - system call number
+ * @param arg1 - first argument (ebx)
+ * @param arg2 - second argument (esi)
+ * @param arg3 - third argument (edi)
+ * @return system call result
+ */
+USER_INLINE int syscall(int num, unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    int ret;
+    asm volatile("int %1"
+                 : "=a"(ret)
+                 : "i"(IRQ_SYSCALL), "a"(num), "b"(arg1), "S"(arg2), "D"(arg3)
+                 : "memory");
+    return ret;
+}
+
+/**
+ * Performs a system call through sysenter
+ * Only for system calls that never block (see syscall_fast_dispatch)
+ * @param num - system call number
+ * @param arg1 - first argument (ebx)
+ * @param arg2 - second argument (esi)
+ * @param arg3 - third argument (edi)
+ * @return system call result
+ */
+USER_INLINE int syscall_fast(int num, unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    int ret;
+    // sysexit returns to edx with the stack pointer in ecx
+    asm volatile("movl %%esp, %%ecx\n"
+                 "movl $1f, %%edx\n"
+                 "sysenter\n"
+                 "1:\n"
+                 : "=a"(ret)
+                 : "a"(num), "b"(arg1), "S"(arg2), "D"(arg3)
+                 : "ecx", "edx", "memory");
+    return ret;
+}
+
+/**
+ * Writes characters to the console
+ * @param buf - characters to write
+ * @param len - number of characters
+ * @return number of characters written, -1 on error
+ */
+USER_INLINE int sys_write(const char *buf, int len) {
+    return syscall_fast(SYSCALL_WRITE, SYSCALL_FD_STDOUT, (unsigned int)buf, len);
+}
+
+/**
+ * Gives up the rest of the current quantum
+ */
+USER_INLINE void sys_yield(void) {
+    syscall(SYSCALL_YIELD, 0, 0, 0);
+}
+
+/**
+ * Sleeps for a number of milliseconds
+ * @param ms - milliseconds
+ * @return 0 on success, -1 on error
+ */
+USER_INLINE int sys_sleep(int ms) {
+    return syscall(SYSCALL_SLEEP, ms, 0, 0);
+}
+
+/**
+ * Gets the process id of the calling process
+ * @return process id
+ */
+USER_INLINE int sys_getpid(void) {
+    return syscall_fast(SYSCALL_GETPID, 0, 0, 0);
+}
+
+/**
+ * Ends the calling process
+ */
+USER_INLINE void sys_exit(void) {
+    syscall(SYSCALL_EXIT, 0, 0, 0);
+}
+
+/**
+ * Clones the calling process
+ * The clone continues from the same point with a copy on write
+ * duplicate of the address space
+ * @return process id of the clone in the calling process, 0 in the
+ *         clone, -1 on error
+ */
+USER_INLINE int sys_clone(void) {
+    return syscall(SYSCALL_CLONE, 0, 0, 0);
+}
+
+/**
+ * Maps the shared system call ring into the calling process
+ * @return pointer to the ring, NULL on error
+ */
+USER_INLINE syscall_ring_t *sys_ring_setup(void) {
+    int ret = syscall(SYSCALL_RING_SETUP, 0, 0, 0);
+    return ret == -1 ? (syscall_ring_t *)0 : (syscall_ring_t *)ret;
+}
+
+/**
+ * Asks the kernel to handle the queued requests right away
+ * @return number of requests handled
+ */
+USER_INLINE int sys_ring_enter(void) {
+    return syscall_fast(SYSCALL_RING_ENTER, 0, 0, 0);
+}
+
+/**
+ * Arms a one-shot timer that posts a completion to the ring
+ * @param ms - milliseconds
+ * @param user_data - value for the completion
+ * @return 0 on success, -1 on error
+ */
+USER_INLINE int sys_timer(int ms, unsigned int user_data) {
+    return syscall_fast(SYSCALL_TIMER, ms, user_data, 0);
+}
+
+/**
+ * Queues a request in the submission ring
+ * The kernel handles it on its next entry, or on sys_ring_enter()
+ * @param ring - shared ring
+ * @param num - system call number
+ * @param arg1 - first argument
+ * @param arg2 - second argument
+ * @param arg3 - third argument
+ * @param user_data - value copied to the completion
+ * @return 0 on success, -1 if the ring is full
+ */
+USER_INLINE int user_ring_submit(syscall_ring_t *ring, int num, unsigned int arg1,
+                                 unsigned int arg2, unsigned int arg3, unsigned int user_data) {
+    unsigned int tail = ring->sq_tail;
+    syscall_sqe_t *sqe;
+
+    if(tail - ring->sq_head >= SYSCALL_RING_ENTRIES) {
+        return -1;
+    }
+    sqe = &ring->sq[tail & (SYSCALL_RING_ENTRIES - 1)];
+    sqe->num = num;
+    sqe->arg1 = arg1;
+    sqe->arg2 = arg2;
+    sqe->arg3 = arg3;
+    sqe->user_data = user_data;
+    // The entry must be complete before the kernel can see it
+    asm volatile("" : : : "memory");
+    ring->sq_tail = tail + 1;
+    return 0;
+}
+
+/**
+ * Takes the next completion from the completion ring
+ * @param ring - shared ring
+ * @param cqe - completion (output)
+ * @return 0 on success, -1 if there are no completions
+ */
+USER_INLINE int user_ring_reap(syscall_ring_t *ring, syscall_cqe_t *cqe) {
+    unsigned int head = ring->cq_head;
+
+    if(head == ring->cq_tail) {
+        return -1;
+    }
+    *cqe = ring->cq[head & (SYSCALL_RING_ENTRIES - 1)];
+    ring->cq_head = head + 1;
+    return 0;
+}
+
+/**
+ * Blocks while a word holds an expected value
+ * @param addr - address of the word
+ * @param expected - value the word must hold to block
+ * @param ms - timeout in milliseconds, 0 to wait forever
+ * @return 0 when woken, -1 on timeout or if the word changed
+ */
+USER_INLINE int sys_futex_wait(volatile unsigned int *addr, unsigned int expected, int ms) {
+    return syscall(SYSCALL_FUTEX_WAIT, (unsigned int)addr, expected, ms);
+}
+
+/**
+ * Wakes processes waiting on a word
+ * @param addr - address of the word
+ * @param count - maximum number of processes to wake
+ * @return number of processes woken, -1 on error
+ */
+USER_INLINE int sys_futex_wake(volatile unsigned int *addr, int count) {
+    return syscall_fast(SYSCALL_FUTEX_WAKE, (unsigned int)addr, count, 0);
+}
+
+// User space mutex, built on a futex
+// Locking and unlocking only enter the kernel when the mutex is contended
+typedef struct user_mutex_t {
+    volatile unsigned int state;    // 0: unlocked, 1: locked, 2: locked with waiters
+} user_mutex_t;
+
+/**
+ * Atomically replaces a word if it holds an expected value
+ * @param addr - address of the word
+ * @param expected - value the word must hold
+ * @param value - new value
+ * @return previous value of the word
+ */
+USER_INLINE unsigned int user_cmpxchg(volatile unsigned int *addr, unsigned int expected, unsigned int value) {
+    unsigned int prev;
+    asm volatile("lock cmpxchgl %2, %1"
+                 : "=a"(prev), "+m"(*addr)
+                 : "r"(value), "0"(expected)
+                 : "memory");
+    return prev;
+}
+
+/**
+ * Atomically replaces a word
+ * @param addr - address of the word
+ * @param value - new value
+ * @return previous value of the word
+ */
+USER_INLINE unsigned int user_xchg(volatile unsigned int *addr, unsigned int value) {
+    asm volatile("xchgl %0, %1" : "+r"(value), "+m"(*addr) : : "memory");
+    return value;
+}
+
+/**
+ * Locks a user space mutex, blocking in the kernel while it is held
+ * @param mutex - mutex
+ */
+USER_INLINE void user_mutex_lock(user_mutex_t *mutex) {
+    unsigned int state = user_cmpxchg(&mutex->state, 0, 1);
+
+    // Mark the mutex contended and wait until it is released
+    if(state != 0 && state != 2) {
+        state = user_xchg(&mutex->state, 2);
+    }
+    while(state != 0) {
+        sys_futex_wait(&mutex->state, 2, 0);
+        state = user_xchg(&mutex->state, 2);
+    }
+}
+
+/**
+ * Unlocks a user space mutex, waking one waiter if there are any
+ * @param mutex - mutex
+ */
+USER_INLINE void user_mutex_unlock(user_mutex_t *mutex) {
+    if(user_xchg(&mutex->state, 0) == 2) {
+        sys_futex_wake(&mutex->state, 1);
+    }
+}
+
+/**
+ * Performs an IPC system call
+ * The message words and page address are passed in and out in
+ * registers (see ipc.h)
+ * @param num - system call number
+ * @param pid - partner process id (edi)
+ * @param msg - message (updated with the message received, if any)
+ * @return system call result
+ */
+USER_INLINE int sys_ipc(int num, int pid, ipc_msg_t *msg) {
+    asm volatile("int %6"
+                 : "+a"(num), "+b"(msg->word[0]), "+c"(msg->word[1]), "+d"(msg->word[2]),
+                   "+S"(msg->page), "+D"(pid)
+                 : "i"(IRQ_SYSCALL)
+                 : "memory");
+    return num;
+}
+
+/**
+ * Sends a message, blocking until the receiver takes it
+ * @param dest - process id of the receiver
+ * @param msg - message; msg->page is a page of the IPC area to move to
+ *              the receiver, or 0
+ * @return 0 on success, -1 on error
+ */
+USER_INLINE int sys_ipc_send(int dest, ipc_msg_t *msg) {
+    return sys_ipc(SYSCALL_IPC_SEND, dest, msg);
+}
+
+/**
+ * Receives a message, blocking until one arrives
+ * @param msg - message (output); msg->page must be set to a page of the
+ *              IPC area to accept a page at, or 0 to refuse pages
+ * @return process id of the sender, -1 on error
+ */
+USER_INLINE int sys_ipc_recv(ipc_msg_t *msg) {
+    return sys_ipc(SYSCALL_IPC_RECV, 0, msg);
+}
+
+/**
+ * Sends a message and waits for the reply
+ * @param dest - process id of the receiver
+ * @param msg - message, replaced by the reply; msg->page is sent if it
+ *              is mapped, and is where a page in the reply is mapped
+ * @return process id of the replier, -1 on error
+ */
+USER_INLINE int sys_ipc_call(int dest, ipc_msg_t *msg) {
+    return sys_ipc(SYSCALL_IPC_CALL, dest, msg);
+}
+
+/**
+ * Replies to a process waiting in sys_ipc_call()
+ * @param dest - process id of the caller
+ * @param msg - reply; msg->page is a page of the IPC area to move to
+ *              the caller, or 0
+ * @return 0 on success, -1 on error
+ */
+USER_INLINE int sys_ipc_reply(int dest, ipc_msg_t *msg) {
+    return sys_ipc(SYSCALL_IPC_REPLY, dest, msg);
+}
+
+/**
+ * Reads the time stamp counter (allowed in ring 3)
+ * @return number of cycles
+ */
+USER_INLINE unsigned long long sys_cycles(void) {
+    unsigned long long cycles;
+    asm volatile("rdtsc" : "=A"(cycles));
+    return cycles;
+}
+
+/**
+ * Gets the timer tick count from the shared time page (no kernel entry)
+ * @return timer ticks
+ */
+USER_INLINE int sys_ticks(void) {
+    clock_page_t *page = (clock_page_t *)CLOCK_PAGE_ADDR;
+    unsigned int seq;
+    int ticks;
+
+    do {
+        seq = page->seq;
+        ticks = page->ticks;
+    } while((seq & 1) || seq != page->seq);
+    return ticks;
+}
+
+/**
+ * Gets the monotonic time from the shared time page (no kernel entry)
+ * Matches clock_get_ns() in the kernel
+ * @return time in nanoseconds
+ */
+USER_INLINE unsigned long long sys_clock_ns(void) {
+    clock_page_t *page = (clock_page_t *)CLOCK_PAGE_ADDR;
+    unsigned long long cycles;
+    unsigned int seq;
+    unsigned int mult;
+    unsigned int shift;
+    int ticks;
+
+    do {
+        seq = page->seq;
+        ticks = page->ticks;
+        cycles = page->boot_cycles;
+        mult = page->mult;
+        shift = page->shift;
+    } while((seq & 1) || seq != page->seq);
+
+    if(!page->khz) {
+        return (unsigned long long)(unsigned int)ticks * (CLOCK_NS_PER_SEC / page->tick_hz);
+    }
+    // Same split multiply as clock_cycles_to_ns()
+    cycles = sys_cycles() - cycles;
+    return (((unsigned long long)(unsigned int)(cycles >> 32) * mult) << (32 - shift)) +
+           (((unsigned long long)(unsigned int)cycles * mult) >> shift);
+}
+
+#endif
@@ -0,0 +1,33 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Deferred work queue
+ */
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+// Maximum number of pending work items
+#ifndef WORKQUEUE_SIZE
+#define WORKQUEUE_SIZE 64
+#endif
+
+/**
+ * Initializes the work queue and starts the kernel worker process
+ * Must be called after the process table has been initialized
+ */
+void workqueue_init(void);
+
+/**
+ * Queues a function to be run by the kernel worker process
+ *
+ * Must be called with interrupts disabled (e.g. from interrupt context);
+ * the function runs later in process context with interrupts enabled.
+ * A function that is already pending is not queued again.
+ * @param func - function to run
+ * @return 0 on success, -1 on error
+ */
+int workqueue_add(void (*func)(void));
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * High-resolution clocksource (TSC calibrated against the PIT)
+ */
+#include <spede/machine/io.h>
+#include <spede/string.h>
+
+#include "clock.h"
+#include "kernel.h"
+#include "timer.h"
+#include "frame.h"
+
+// PIT channel 2 definitions (used only for calibration)
+#define PIT_FREQ        1193182     // PIT input clock (Hz)
+#define PIT_CH2_DATA    0x42        // Channel 2 data port
+#define PIT_CMD         0x43        // Mode/command port
+#define PIT_CMD_CH2     0xb0        // Channel 2, lo/hi, mode 0
+#define PIT_CH2_GATE    0x61        // Channel 2 gate/speaker control port
+#define PIT_CH2_OUT     0x20        // Channel 2 output status bit
+
+// Calibration period (in PIT counts, roughly 10ms)
+#define CLOCK_CALIBRATE_COUNT (PIT_FREQ / 100)
+
+// Cycle count when the clock was initialized
+unsigned long long clock_boot_cycles;
+
+// Calibrated TSC frequency in kHz
+unsigned int clock_khz;
+
+// Cycle to nanosecond conversion: ns = (cycles * clock_mult) >> clock_shift
+unsigned int clock_mult;
+unsigned int clock_shift;
+
+// Shared time page
+clock_page_t *clock_page;
+
+/**
+ * Returns the current value of the time stamp counter
+ * @return CPU cycle count
+ */
+unsigned long long clock_get_cycles(void) {
+    unsigned int low;
+    unsigned int high;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((unsigned long long)high << 32) | low;
+}
+
+/**
+ * Calibrates the time stamp counter against the PIT
+ * Must be called with interrupts disabled
+ */
+void clock_init(void) {
+    unsigned long long start;
+    unsigned long long cycles;
+    unsigned long long mult;
+    int gate;
+
+    kernel_log_info("Initializing clocksource");
+
+    // Program channel 2 for a one-shot countdown with the speaker off
+    gate = inportb(PIT_CH2_GATE) & ~0x03;
+    outportb(PIT_CH2_GATE, gate);
+    outportb(PIT_CMD, PIT_CMD_CH2);
+    outportb(PIT_CH2_DATA, CLOCK_CALIBRATE_COUNT & 0xff);
+    outportb(PIT_CH2_DATA, (CLOCK_CALIBRATE_COUNT >> 8) & 0xff);
+
+    // Raising the gate starts the countdown; the output goes high at zero
+    outportb(PIT_CH2_GATE, gate | 0x01);
+    start = clock_get_cycles();
+    while(!(inportb(PIT_CH2_GATE) & PIT_CH2_OUT));
+    cycles = clock_get_cycles() - start;
+    outportb(PIT_CH2_GATE, gate);
+
+    // cycles per CLOCK_CALIBRATE_COUNT PIT counts -> kHz
+    clock_khz = clock_div64(cycles * PIT_FREQ, CLOCK_CALIBRATE_COUNT * 1000, NULL);
+    if(clock_khz == 0) {
+        kernel_log_warn("Unable to calibrate the TSC; using the timer tick");
+        return;
+    }
+
+    // Pick the largest shift that keeps the multiplier within 32 bits
+    clock_shift = 32;
+    do {
+        mult = clock_div64((unsigned long long)(CLOCK_NS_PER_SEC / 1000) << clock_shift, clock_khz, NULL);
+    } while((mult >> 32) && --clock_shift);
+    clock_mult = mult;
+
+    clock_boot_cycles = clock_get_cycles();
+    kernel_log_info("TSC calibrated at %u kHz", clock_khz);
+}
+
+/**
+ * Allocates the shared time page and fills in the calibration values
+ * Must be called after clock_init() and frame_init()
+ */
+void clock_page_init(void) {
+    clock_page_t *page = frame_alloc(0);
+
+    if(!page) {
+        kernel_panic("Unable to allocate the time page!");
+    }
+    // The whole frame is visible to user processes
+    memset(page, 0, PAGE_SIZE);
+    page->tick_hz = TIMER_HZ;
+    page->khz = clock_khz;
+    page->mult = clock_mult;
+    page->shift = clock_shift;
+    page->boot_cycles = clock_boot_cycles;
+    clock_page = page;
+    clock_page_update();
+}
+
+/**
+ * Publishes the current tick count in the shared time page
+ * Called by the timer on every tick (and after a tickless period)
+ */
+void clock_page_update(void) {
+    if(!clock_page) {
+        return;
+    }
+    // Readers in user space may be interrupted mid-read; an odd or
+    // changed sequence number tells them to retry
+    clock_page->seq++;
+    asm volatile("" : : : "memory");
+    clock_page->ticks = timer_get_system_time();
+    clock_page->tick_cycles = clock_get_cycles();
+    asm volatile("" : : : "memory");
+    clock_page->seq++;
+}
+
+/**
+ * Converts a cycle count (or difference) to nanoseconds
+ * @param cycles - number of CPU cycles
+ * @return nanoseconds
+ */
+unsigned long long clock_cycles_to_ns(unsigned long long cycles) {
+    unsigned int high = cycles >> 32;
+    unsigned int low = cycles;
+
+    // Split the multiply so the 96-bit intermediate never overflows
+    return (((unsigned long long)high * clock_mult) << (32 - clock_shift)) +
+           (((unsigned long long)low * clock_mult) >> clock_shift);
+}
+
+/**
+ * Returns the monotonic time since the clock was initialized
+ * @return time in nanoseconds
+ */
+unsigned long long clock_get_ns(void) {
+    if(!clock_khz) {
+        return (unsigned long long)(unsigned int)timer_get_system_time() * (CLOCK_NS_PER_SEC / TIMER_HZ);
+    }
+    return clock_cycles_to_ns(clock_get_cycles() - clock_boot_cycles);
+}
+
+/**
+ * Returns the calibrated time stamp counter frequency
+ * @return frequency in kHz, 0 if the TSC could not be calibrated
+ */
+unsigned int clock_get_khz(void) {
+    return clock_khz;
+}
@@ -0,0 +1,365 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Physical page frame allocator
+ *
+ * Free memory is managed with a buddy system: a block of order n holds
+ * 1 << n frames and is aligned to its size (relative to the first
+ * managed frame), so its buddy is found by flipping bit n of its frame
+ * index. Allocation splits larger blocks and freeing merges buddies,
+ * both in O(FRAME_MAX_ORDER) steps.
+ */
+#include <spede/machine/io.h>
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "frame.h"
+
+// CMOS ports and memory size registers
+#define CMOS_ADDR           0x70
+#define CMOS_DATA           0x71
+#define CMOS_EXT_MEM_LOW    0x30    // KB above 1MB (up to 64MB)
+#define CMOS_EXT_MEM_HIGH   0x31
+#define CMOS_HIGH_MEM_LOW   0x34    // 64KB blocks above 16MB
+#define CMOS_HIGH_MEM_HIGH  0x35
+
+// Frame info flags: frame is the first frame of a free block, or of an
+// allocated block
+#define FRAME_INFO_FREE     0x80
+#define FRAME_INFO_ALLOC    0x40
+#define FRAME_INFO_ORDER    0x3f
+
+// End of the kernel image (provided by the linker)
+extern char _end[];
+
+// Free block, linked through the first bytes of the block itself
+typedef struct frame_block_t {
+    struct frame_block_t *next;
+    struct frame_block_t *prev;
+} frame_block_t;
+
+// First managed frame and number of managed frames
+unsigned int frame_base;
+int frame_count;
+
+// Per-frame info: order of the block starting at the frame, and
+// whether it is free or allocated
+unsigned char *frame_info;
+
+// Per-frame reference counts (for frames shared between address spaces)
+unsigned short *frame_refs;
+
+// Free blocks of each order
+frame_block_t *frame_free_list[FRAME_ORDERS];
+int frame_free_blocks[FRAME_ORDERS];
+
+// Number of free frames
+int frame_free_frames;
+
+/**
+ * Reads a CMOS register
+ * @param reg - register number
+ * @return register value
+ */
+static unsigned char cmos_read(unsigned char reg) {
+    outportb(CMOS_ADDR, reg);
+    return inportb(CMOS_DATA);
+}
+
+/**
+ * Gets the physical address of a frame
+ * @param index - frame index
+ * @return pointer to the frame
+ */
+static inline frame_block_t *frame_addr(int index) {
+    return (frame_block_t *)(frame_base + index * PAGE_SIZE);
+}
+
+/**
+ * Gets the index of a frame
+ * @param addr - pointer to the frame
+ * @return frame index
+ */
+static inline int frame_index(void *addr) {
+    return ((unsigned int)addr - frame_base) / PAGE_SIZE;
+}
+
+/**
+ * Adds a block to the free list for its order
+ * @param index - index of the first frame of the block
+ * @param order - block order
+ */
+static void frame_list_add(int index, int order) {
+    frame_block_t *block = frame_addr(index);
+
+    block->prev = NULL;
+    block->next = frame_free_list[order];
+    if(block->next) {
+        block->next->prev = block;
+    }
+    frame_free_list[order] = block;
+    frame_free_blocks[order]++;
+    frame_info[index] = FRAME_INFO_FREE | order;
+}
+
+/**
+ * Removes a block from the free list for its order
+ * @param index - index of the first frame of the block
+ * @param order - block order
+ */
+static void frame_list_remove(int index, int order) {
+    frame_block_t *block = frame_addr(index);
+
+    if(block->prev) {
+        block->prev->next = block->next;
+    } else {
+        frame_free_list[order] = block->next;
+    }
+    if(block->next) {
+        block->next->prev = block->prev;
+    }
+    frame_free_blocks[order]--;
+    frame_info[index] = order;
+}
+
+/**
+ * Discovers the installed memory and adds every frame after the
+ * kernel image to the allocator
+ */
+void frame_init(void) {
+    unsigned int mem_kb;
+    unsigned int top;
+    int info_frames;
+    int index;
+
+    kernel_log_info("Initializing page frame allocator");
+
+    // Installed memory from the CMOS: the extended memory count only
+    // goes up to 64MB, so larger machines report the rest above 16MB
+    mem_kb = cmos_read(CMOS_HIGH_MEM_LOW) | (cmos_read(CMOS_HIGH_MEM_HIGH) << 8);
+    if(mem_kb) {
+        mem_kb = 16 * 1024 + mem_kb * 64;
+    } else {
+        mem_kb = cmos_read(CMOS_EXT_MEM_LOW) | (cmos_read(CMOS_EXT_MEM_HIGH) << 8);
+        if(mem_kb) {
+            mem_kb += 1024;
+        }
+    }
+    if(!mem_kb) {
+        kernel_log_warn("Unable to detect memory size, assuming %d KB", FRAME_MEMORY_DEFAULT_KB);
+        mem_kb = FRAME_MEMORY_DEFAULT_KB;
+    }
+    if(mem_kb > FRAME_MEMORY_MAX_KB) {
+        mem_kb = FRAME_MEMORY_MAX_KB;
+    }
+    top = (mem_kb * 1024) & ~(PAGE_SIZE - 1);
+
+    // Manage everything from the first page after the kernel image
+    frame_base = ((unsigned int)_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if(top <= frame_base) {
+        kernel_panic("No memory available after the kernel image!");
+    }
+    frame_count = (top - frame_base) / PAGE_SIZE;
+
+    // The frame info and reference count tables take the first frames
+    // of the region
+    frame_info = (unsigned char *)frame_base;
+    frame_refs = (unsigned short *)(frame_base + ((frame_count + 1) & ~1));
+    info_frames = (((frame_count + 1) & ~1) + frame_count * sizeof(unsigned short) + PAGE_SIZE - 1) / PAGE_SIZE;
+    memset(frame_info, 0, frame_count);
+    memset(frame_refs, 0, frame_count * sizeof(unsigned short));
+
+    memset(frame_free_list, 0, sizeof(frame_free_list));
+    memset(frame_free_blocks, 0, sizeof(frame_free_blocks));
+    frame_free_frames = 0;
+
+    // Add the remaining frames as the largest aligned blocks that fit
+    index = info_frames;
+    while(index < frame_count) {
+        int order = FRAME_MAX_ORDER;
+        while(order > 0 && ((index & ((1 << order) - 1)) || index + (1 << order) > frame_count)) {
+            order--;
+        }
+        frame_list_add(index, order);
+        frame_free_frames += 1 << order;
+        index += 1 << order;
+    }
+
+    kernel_log_info("Memory: %d KB, %d frames free from 0x%x", mem_kb, frame_free_frames, frame_base);
+}
+
+/**
+ * Allocates a block of contiguous page frames
+ * Must be called with interrupts disabled
+ * @param order - block order (the block holds 1 << order frames)
+ * @return physical address of the block (page aligned), NULL if out of memory
+ */
+void *frame_alloc(int order) {
+    int index;
+    int o;
+
+    if(order < 0 || order > FRAME_MAX_ORDER) {
+        return NULL;
+    }
+
+    // Find the smallest free block that is large enough
+    for(o = order; o <= FRAME_MAX_ORDER && !frame_free_list[o]; o++);
+    if(o > FRAME_MAX_ORDER) {
+        return NULL;
+    }
+    index = frame_index(frame_free_list[o]);
+    frame_list_remove(index, o);
+
+    // Split it, returning the upper halves to the free lists
+    while(o > order) {
+        o--;
+        frame_list_add(index + (1 << o), o);
+    }
+    frame_info[index] = FRAME_INFO_ALLOC | order;
+    frame_refs[index] = 1;
+    frame_free_frames -= 1 << order;
+    return frame_addr(index);
+}
+
+/**
+ * Frees a block of page frames, merging it with its free buddies
+ * Must be called with interrupts disabled
+ * @param addr - physical address returned by frame_alloc
+ */
+void frame_free(void *addr) {
+    int index;
+    int order;
+
+    if(!addr) {
+        return;
+    }
+    index = frame_index(addr);
+    if((unsigned int)addr < frame_base || index >= frame_count ||
+       ((unsigned int)addr & (PAGE_SIZE - 1)) || !(frame_info[index] & FRAME_INFO_ALLOC)) {
+        // Free blocks, frames inside a block and absorbed buddies are
+        // all rejected; only the first frame of an allocated block is valid
+        kernel_log_error("frame_free: invalid frame %p!", addr);
+        return;
+    }
+    order = frame_info[index] & FRAME_INFO_ORDER;
+    frame_info[index] = 0;
+    frame_refs[index] = 0;
+    frame_free_frames += 1 << order;
+
+    // Merge with the buddy while it is a free block of the same order
+    while(order < FRAME_MAX_ORDER) {
+        int buddy = index ^ (1 << order);
+        if(buddy >= frame_count || frame_info[buddy] != (FRAME_INFO_FREE | order)) {
+            break;
+        }
+        frame_list_remove(buddy, order);
+        frame_info[buddy] = 0;
+        if(buddy < index) {
+            index = buddy;
+        }
+        order++;
+    }
+    frame_list_add(index, order);
+}
+
+/**
+ * Adds a reference to an allocated block
+ * Must be called with interrupts disabled
+ * @param addr - physical address returned by frame_alloc
+ */
+void frame_get(void *addr) {
+    frame_refs[frame_index(addr)]++;
+}
+
+/**
+ * Drops a reference to an allocated block, freeing it with the last one
+ * Must be called with interrupts disabled
+ * @param addr - physical address returned by frame_alloc
+ */
+void frame_put(void *addr) {
+    int index = frame_index(addr);
+
+    if(frame_refs[index] > 1) {
+        frame_refs[index]--;
+    } else {
+        frame_free(addr);
+    }
+}
+
+/**
+ * Gets the number of references to an allocated block
+ * @param addr - physical address returned by frame_alloc
+ * @return reference count
+ */
+int frame_refcount(void *addr) {
+    return frame_refs[frame_index(addr)];
+}
+
+/**
+ * Finds the smallest block order that holds a number of bytes
+ * @param size - number of bytes
+ * @return block order, -1 if the size is larger than the largest block
+ */
+int frame_order(int size) {
+    for(int order = 0; order <= FRAME_MAX_ORDER; order++) {
+        if(size <= (PAGE_SIZE << order)) {
+            return order;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Gets the end of physical memory
+ * @return physical address after the last usable frame
+ */
+unsigned int frame_memory_top(void) {
+    return frame_base + frame_count * PAGE_SIZE;
+}
+
+/**
+ * Gets the number of free page frames
+ * @return number of free frames
+ */
+int frame_free_count(void) {
+    return frame_free_frames;
+}
+
+/**
+ * Gets the fragmentation of free memory
+ * @return percentage of free memory that is not in the largest free block
+ */
+int frame_fragmentation(void) {
+    int largest = 0;
+
+    if(frame_free_frames == 0) {
+        return 0;
+    }
+    for(int order = FRAME_MAX_ORDER; order >= 0; order--) {
+        if(frame_free_blocks[order]) {
+            largest = 1 << order;
+            break;
+        }
+    }
+    // Memory made only of maximum size blocks is never fragmented
+    if(largest == (1 << FRAME_MAX_ORDER)) {
+        largest = frame_free_blocks[FRAME_MAX_ORDER] << FRAME_MAX_ORDER;
+    }
+    return 100 - largest * 100 / frame_free_frames;
+}
+
+/**
+ * Logs the free block counts for each order and the fragmentation
+ */
+void frame_stats(void) {
+    kernel_log_info("frames: %d of %d free, fragmentation %d%%",
+                    frame_free_frames, frame_count, frame_fragmentation());
+    for(int order = 0; order <= FRAME_MAX_ORDER; order++) {
+        if(frame_free_blocks[order]) {
+            kernel_log_info("  order %2d (%5d KB): %d free", order,
+                            (PAGE_SIZE << order) / 1024, frame_free_blocks[order]);
+        }
+    }
+}
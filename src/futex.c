@@ -0,0 +1,157 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Futexes (wait/wake on memory words)
+ */
+#include "kernel.h"
+#include "kproc.h"
+#include "paging.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "futex.h"
+
+// Futex wait queues, indexed by the hash of the futex key
+proc_queue_t futex_table[FUTEX_HASH_SIZE];
+
+/**
+ * Hashes a futex key
+ * @param key - physical address of the word
+ * @return wait queue for the key
+ */
+static inline proc_queue_t *futex_queue(unsigned int key) {
+    // Multiplicative hash; the low bits of a word address carry little
+    return &futex_table[((key >> 2) * 2654435761u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+/**
+ * Finds the key (physical address) of a word of the current process
+ * A copy on write page is made private first, since a write by either
+ * address space would move the word to another frame
+ * @param addr - address of the word
+ * @return physical address of the word, 0 if the address is invalid
+ */
+static unsigned int futex_key(unsigned int addr) {
+    pte_t *pte;
+
+    if(!addr || (addr & (sizeof(unsigned int) - 1))) {
+        return 0;
+    }
+    if(current->type == PROC_TYPE_USER &&
+       !paging_user_access(current->page_dir, addr, sizeof(unsigned int))) {
+        return 0;
+    }
+    // Below the user region, memory is identity mapped
+    if(addr < PAGING_USER_BASE) {
+        return addr;
+    }
+    pte = paging_get_pte(current->page_dir, addr);
+    if(!pte || !(*pte & PAGING_PRESENT)) {
+        return 0;
+    }
+    if((*pte & PAGING_COW) && paging_cow_fault(current->page_dir, addr) == -1) {
+        return 0;
+    }
+    return (*pte & PAGING_ADDR_MASK) | (addr & ~PAGING_ADDR_MASK);
+}
+
+/**
+ * Ends a futex wait that timed out (timer callback)
+ * @param arg - process id
+ */
+static void futex_timeout(void *arg) {
+    // The process may have been woken or destroyed in the meantime
+    proc_t *proc = pid_to_proc((int)arg);
+
+    if(!proc || proc->state != BLOCKED || proc->queue != futex_queue(proc->futex_key)) {
+        return;
+    }
+    proc_queue_remove(proc->queue, proc);
+    proc->futex_timer = -1;
+    proc->trapframe->eax = -1;
+    scheduler_wake(proc);
+}
+
+/**
+ * Initializes the futex hash table
+ */
+void futex_init(void) {
+    kernel_log_info("Initializing futexes");
+    for(int i = 0; i < FUTEX_HASH_SIZE; i++) {
+        proc_queue_init(&futex_table[i]);
+    }
+}
+
+/**
+ * Blocks the current process if a word still holds an expected value
+ * Must be called from a system call: the process is switched out when
+ * the system call returns, and the result of the system call is
+ * replaced with -1 if the timeout expires first
+ * @param addr - address of the word (in the current address space)
+ * @param expected - value the word must hold for the process to block
+ * @param ms - timeout in milliseconds, 0 to wait forever
+ * @return 0 if the process blocked, -1 if the word changed or the
+ *         address is invalid
+ */
+int futex_wait(unsigned int addr, unsigned int expected, int ms) {
+    unsigned int key = futex_key(addr);
+    int ticks;
+
+    if(!key || ms < 0) {
+        return -1;
+    }
+    ticks = timer_ms_to_ticks(ms);
+    // Interrupts are disabled, so no waker can run between the check
+    // and the process joining the wait queue
+    if(*(volatile unsigned int *)key != expected) {
+        return -1;
+    }
+
+    current->futex_timer = -1;
+    if(ticks > 0) {
+        current->futex_timer = timer_callback_register_arg(futex_timeout, (void *)current->pid, ticks, 0, 0);
+        if(current->futex_timer == -1) {
+            return -1;
+        }
+    }
+    current->futex_key = key;
+    proc_queue_in(futex_queue(key), current);
+    current->state = BLOCKED;
+    return 0;
+}
+
+/**
+ * Wakes processes waiting on a word
+ * @param addr - address of the word (in the current address space)
+ * @param count - maximum number of processes to wake
+ * @return number of processes woken, -1 if the address is invalid
+ */
+int futex_wake(unsigned int addr, int count) {
+    unsigned int key = futex_key(addr);
+    proc_queue_t *queue;
+    proc_t *proc;
+    proc_t *next;
+    int woken = 0;
+
+    if(!key) {
+        return -1;
+    }
+    // Other keys may share the wait queue; waiters are woken in the
+    // order they started waiting
+    queue = futex_queue(key);
+    for(proc = queue->head; proc && woken < count; proc = next) {
+        next = proc->next;
+        if(proc->futex_key != key) {
+            continue;
+        }
+        proc_queue_remove(queue, proc);
+        if(proc->futex_timer != -1) {
+            timer_callback_unregister(proc->futex_timer);
+            proc->futex_timer = -1;
+        }
+        scheduler_wake(proc);
+        woken++;
+    }
+    return woken;
+}
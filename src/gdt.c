@@ -0,0 +1,114 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Global descriptor table and task state segments
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "gdt.h"
+
+// Descriptor access bytes
+#define GDT_ACCESS_KCODE    0x9a    // Present, ring 0, code, readable
+#define GDT_ACCESS_KDATA    0x92    // Present, ring 0, data, writable
+#define GDT_ACCESS_UCODE    0xfa    // Present, ring 3, code, readable
+#define GDT_ACCESS_UDATA    0xf2    // Present, ring 3, data, writable
+#define GDT_ACCESS_TSS      0x89    // Present, ring 0, available 32-bit TSS
+
+// Descriptor flags: 4KB granularity, 32-bit
+#define GDT_FLAGS_FLAT      0xc
+
+// Segment descriptor
+typedef struct gdt_entry_t {
+    unsigned short limit_low;
+    unsigned short base_low;
+    unsigned char base_mid;
+    unsigned char access;
+    unsigned char limit_flags;  // Limit bits 16-19, flags in the upper nibble
+    unsigned char base_high;
+} gdt_entry_t;
+
+// Descriptor table register contents
+typedef struct gdt_ptr_t {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed)) gdt_ptr_t;
+
+// Global descriptor table
+gdt_entry_t gdt[GDT_ENTRIES];
+
+// Main task state segment
+tss_t tss;
+
+/**
+ * Fills in a segment descriptor
+ * @param selector - segment selector
+ * @param base - segment base address
+ * @param limit - segment limit (20 bits)
+ * @param access - access byte
+ * @param flags - granularity/size flags
+ */
+static void gdt_set(int selector, unsigned int base, unsigned int limit,
+                    unsigned char access, unsigned char flags) {
+    gdt_entry_t *entry = &gdt[selector >> 3];
+
+    entry->limit_low = limit & 0xffff;
+    entry->base_low = base & 0xffff;
+    entry->base_mid = (base >> 16) & 0xff;
+    entry->access = access;
+    entry->limit_flags = ((limit >> 16) & 0xf) | (flags << 4);
+    entry->base_high = (base >> 24) & 0xff;
+}
+
+/**
+ * Installs a task state segment descriptor
+ * @param selector - segment selector for the descriptor
+ * @param task - pointer to the task state segment
+ */
+void gdt_set_tss(int selector, tss_t *task) {
+    gdt_set(selector, (unsigned int)task, sizeof(tss_t) - 1, GDT_ACCESS_TSS, 0);
+}
+
+/**
+ * Loads the kernel GDT (flat code and data segments plus the task
+ * state segments) and the main task register
+ */
+void gdt_init(void) {
+    gdt_ptr_t gdt_ptr;
+
+    kernel_log_info("Initializing GDT");
+
+    // The code and data segments match the ones the kernel was loaded with
+    memset(gdt, 0, sizeof(gdt));
+    gdt_set(KCODE_SEG, 0, 0xfffff, GDT_ACCESS_KCODE, GDT_FLAGS_FLAT);
+    gdt_set(KDATA_SEG, 0, 0xfffff, GDT_ACCESS_KDATA, GDT_FLAGS_FLAT);
+    gdt_set(GDT_UCODE_SEG, 0, 0xfffff, GDT_ACCESS_UCODE, GDT_FLAGS_FLAT);
+    gdt_set(GDT_UDATA_SEG, 0, 0xfffff, GDT_ACCESS_UDATA, GDT_FLAGS_FLAT);
+
+    // The main task provides the ring 0 stack for interrupts from ring 3
+    // (esp0 is set on each switch to a process) and is switched back to
+    // from the page fault task; no I/O permission bitmap
+    memset(&tss, 0, sizeof(tss));
+    tss.ss0 = KDATA_SEG;
+    tss.iomap = sizeof(tss_t);
+    gdt_set_tss(GDT_TSS_SEG, &tss);
+
+    gdt_ptr.limit = sizeof(gdt) - 1;
+    gdt_ptr.base = (unsigned int)gdt;
+    asm volatile("lgdt %0" : : "m"(gdt_ptr));
+
+    // Reload the segment registers from the new table
+    asm volatile("ljmp %0, $1f\n"
+                 "1:\n"
+                 "movw %1, %%ax\n"
+                 "movw %%ax, %%ds\n"
+                 "movw %%ax, %%es\n"
+                 "movw %%ax, %%fs\n"
+                 "movw %%ax, %%gs\n"
+                 "movw %%ax, %%ss\n"
+                 : : "i"(KCODE_SEG), "i"(KDATA_SEG) : "eax", "memory");
+
+    asm volatile("ltr %w0" : : "r"(GDT_TSS_SEG));
+}
@@ -49,6 +49,26 @@ void interrupts_disable(void) {
     asm("cli");
 }
 
+/**
+ * Disables interrupts with the CPU, saving the previous state
+ * @return previous EFLAGS value (for interrupts_restore)
+ */
+int interrupts_save(void) {
+    int flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/**
+ * Restores the interrupt state saved by interrupts_save
+ * @param flags - value returned by interrupts_save
+ */
+void interrupts_restore(int flags) {
+    if(flags & EF_INTR) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
 /**
  * Handles the specified interrupt by dispatching to the registered function
  * @param interrupt - interrupt number
@@ -93,6 +113,29 @@ void interrupts_irq_register(int irq, irq_handler_t entry, irq_handler_t handler
     }
 }
 
+/**
+ * Registers an interrupt gate that ring 3 code may invoke with the
+ * int instruction (for system calls)
+ * @param irq - interrupt number
+ * @param entry - the function to run when the interrupt occurs
+ */
+void interrupts_user_gate_register(int irq, irq_handler_t entry) {
+    if(!entry) {
+        kernel_panic("Invalid IDT entry sent for registration!");
+    }
+    fill_gate(&idt[irq], (int)entry, get_cs(), ACC_INTR_GATE | ACC_PL_U, 0);
+}
+
+/**
+ * Registers a task gate for the specified interrupt
+ * The interrupt is handled by switching to the given task
+ * @param irq - interrupt number
+ * @param selector - segment selector of the task state segment
+ */
+void interrupts_task_gate_register(int irq, int selector) {
+    fill_gate(&idt[irq], 0, selector, ACC_TASK_GATE, 0);
+}
+
 /**
  * Enables the specified IRQ on the PIC
  *
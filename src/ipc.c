@@ -0,0 +1,299 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Message passing between processes
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "kproc.h"
+#include "paging.h"
+#include "frame.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "ipc.h"
+
+#if (IPC_AREA_ADDR >> 22) != (CLOCK_PAGE_ADDR >> 22) || \
+    ((IPC_AREA_ADDR + IPC_AREA_PAGES * PAGE_SIZE - 1) >> 22) != (CLOCK_PAGE_ADDR >> 22)
+#error "The IPC area must share the page table of the time page"
+#endif
+
+/**
+ * Checks if an address is a page of the IPC area
+ * @param addr - address
+ * @return 1 if true, 0 if false
+ */
+static inline int ipc_area_page(unsigned int addr) {
+    return addr >= IPC_AREA_ADDR && addr < IPC_AREA_ADDR + IPC_AREA_PAGES * PAGE_SIZE &&
+           !(addr & ~PAGING_ADDR_MASK);
+}
+
+/**
+ * Gets the page a process sends with its message
+ * @param proc - sending process
+ * @return page address, 0 if the page address is not set or not mapped
+ */
+static unsigned int ipc_page(proc_t *proc) {
+    unsigned int addr = proc->trapframe->esi;
+    pte_t *pte;
+
+    if(!addr || proc->type != PROC_TYPE_USER) {
+        return 0;
+    }
+    pte = paging_get_pte(proc->page_dir, addr);
+    if(!pte || !(*pte & PAGING_PRESENT)) {
+        return 0;
+    }
+    return addr;
+}
+
+/**
+ * Validates the page address passed by the current process
+ * @param mapped - 1 if the page must be mapped (it is sent), 0 if it
+ *                 may be just a place to receive a page
+ * @return 0 if the address is valid (or 0), -1 otherwise
+ */
+static int ipc_page_check(int mapped) {
+    unsigned int addr = current->trapframe->esi;
+
+    if(!addr) {
+        return 0;
+    }
+    if(current->type != PROC_TYPE_USER || !ipc_area_page(addr)) {
+        return -1;
+    }
+    if(mapped && !ipc_page(current)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Looks up the partner of an IPC operation
+ * @param pid - process id
+ * @return process entry, NULL if the process cannot take part in IPC
+ */
+static proc_t *ipc_partner(int pid) {
+    proc_t *proc = pid_to_proc(pid);
+
+    if(!proc || proc == current || proc->pid == 0 || proc->state == ZOMBIE) {
+        return NULL;
+    }
+    return proc;
+}
+
+/**
+ * Copies a message from one process to another
+ * The message words are copied between the trapframes; a page is
+ * moved by remapping it from the sender to the receive page address of
+ * the receiver, replacing whatever was mapped there
+ * @param from - sending process
+ * @param to - receiving process
+ * @return 0 on success, -1 if the receiver does not accept a page
+ */
+static int ipc_deliver(proc_t *from, proc_t *to) {
+    unsigned int page = ipc_page(from);
+    pte_t pte;
+
+    if(page && (!to->ipc_window || to->type != PROC_TYPE_USER)) {
+        return -1;
+    }
+
+    to->trapframe->ebx = from->trapframe->ebx;
+    to->trapframe->ecx = from->trapframe->ecx;
+    to->trapframe->edx = from->trapframe->edx;
+    to->trapframe->esi = 0;
+    to->trapframe->eax = from->pid;
+
+    if(page) {
+        pte = paging_unmap(to->page_dir, to->ipc_window);
+        if(pte & PAGING_OWNED) {
+            frame_put((void *)(pte & PAGING_ADDR_MASK));
+        }
+        // The reference to the frame moves with the mapping. The page
+        // table of the IPC area always exists (the time page is mapped
+        // in every user process), so the mapping cannot fail
+        pte = paging_unmap(from->page_dir, page);
+        paging_map(to->page_dir, to->ipc_window, pte & PAGING_ADDR_MASK, pte & PAGING_FLAGS_MASK);
+        to->trapframe->esi = to->ipc_window;
+    }
+    return 0;
+}
+
+/**
+ * Ends the IPC operation of a blocked process and wakes it
+ * @param proc - blocked process
+ * @param result - result of its system call, -1 on error (otherwise
+ *                 the result set by ipc_deliver() is kept)
+ */
+static void ipc_finish(proc_t *proc, int result) {
+    if(result == -1) {
+        proc->trapframe->eax = -1;
+    }
+    proc->ipc_state = IPC_NONE;
+    scheduler_wake(proc);
+}
+
+/**
+ * Sends a message to a process or joins its mailbox
+ * @param to - receiving process
+ * @param state - IPC_SEND or IPC_CALL
+ * @return 0 on success, -1 if the receiver refuses the message
+ */
+static int ipc_send_to(proc_t *to, ipc_state_t state) {
+    // A receiver that is already waiting takes the message right away
+    if(to->state == BLOCKED && to->ipc_state == IPC_RECEIVE) {
+        if(ipc_deliver(current, to) == -1) {
+            return -1;
+        }
+        ipc_finish(to, 0);
+        if(state == IPC_CALL) {
+            current->ipc_state = IPC_REPLY_WAIT;
+            proc_queue_in(&to->ipc_callers, current);
+            current->state = BLOCKED;
+        }
+        return 0;
+    }
+
+    current->ipc_state = state;
+    proc_queue_in(&to->ipc_senders, current);
+    current->state = BLOCKED;
+    return 0;
+}
+
+/**
+ * send(dest)
+ * Sends a message, blocking until the destination takes it
+ * @param dest - process id of the receiver
+ * @return 0 if the message is taken or the process blocked, -1 on error
+ *         (the result becomes -1 if the message is refused later)
+ */
+int ipc_send(int dest) {
+    proc_t *to = ipc_partner(dest);
+
+    if(!to || ipc_page_check(1) == -1) {
+        return -1;
+    }
+    return ipc_send_to(to, IPC_SEND);
+}
+
+/**
+ * receive()
+ * Takes the next message from the mailbox, blocking until one arrives
+ * A page in the message is mapped at the page address passed in esi
+ * (messages with a page are refused if it is 0)
+ * @return process id of the sender (once a message is taken), -1 on error
+ */
+int ipc_receive(void) {
+    proc_t *from;
+
+    if(ipc_page_check(0) == -1) {
+        return -1;
+    }
+    current->ipc_window = current->trapframe->esi;
+
+    while((from = proc_queue_out(&current->ipc_senders)) != NULL) {
+        if(ipc_deliver(from, current) == -1) {
+            ipc_finish(from, -1);
+            continue;
+        }
+        if(from->ipc_state == IPC_CALL) {
+            // The caller stays blocked until the reply
+            from->ipc_state = IPC_REPLY_WAIT;
+            proc_queue_in(&current->ipc_callers, from);
+        } else {
+            ipc_finish(from, 0);
+        }
+        return from->pid;
+    }
+
+    current->ipc_state = IPC_RECEIVE;
+    current->state = BLOCKED;
+    return 0;
+}
+
+/**
+ * call(dest)
+ * Sends a message and waits for the reply from the destination
+ * The page address passed in esi is sent if it is mapped, and is where
+ * a page in the reply is mapped
+ * @param dest - process id of the receiver
+ * @return process id of the replier (once the reply arrives), -1 on error
+ */
+int ipc_call(int dest) {
+    proc_t *to = ipc_partner(dest);
+
+    if(!to || ipc_page_check(0) == -1) {
+        return -1;
+    }
+    current->ipc_window = current->trapframe->esi;
+    return ipc_send_to(to, IPC_CALL);
+}
+
+/**
+ * reply(dest)
+ * Replies to a process waiting in call(); never blocks
+ * @param dest - process id of the caller
+ * @return 0 on success, -1 if the process is not waiting for a reply
+ *         from the current process, or refuses the page
+ */
+int ipc_reply(int dest) {
+    proc_t *to = pid_to_proc(dest);
+
+    if(!to || to->queue != &current->ipc_callers || ipc_page_check(1) == -1) {
+        return -1;
+    }
+    if(ipc_deliver(current, to) == -1) {
+        return -1;
+    }
+    proc_queue_remove(&current->ipc_callers, to);
+    ipc_finish(to, 0);
+    return 0;
+}
+
+/**
+ * Fails the IPC operations of every process waiting on a process that
+ * is exiting
+ * Must be called with interrupts disabled
+ * @param proc - process entry
+ */
+void ipc_exit(proc_t *proc) {
+    proc_t *waiter;
+
+    while((waiter = proc_queue_out(&proc->ipc_senders)) != NULL) {
+        ipc_finish(waiter, -1);
+    }
+    while((waiter = proc_queue_out(&proc->ipc_callers)) != NULL) {
+        ipc_finish(waiter, -1);
+    }
+    proc->ipc_state = IPC_NONE;
+}
+
+/**
+ * Maps a new page into the IPC area of a process after a page fault
+ * @param proc - process entry
+ * @param addr - faulting address
+ * @return 0 on success, -1 if the address is outside the IPC area or
+ *         there is no memory
+ */
+int ipc_area_fault(proc_t *proc, unsigned int addr) {
+    void *frame;
+
+    if(proc->type != PROC_TYPE_USER || !ipc_area_page(addr & PAGING_ADDR_MASK)) {
+        return -1;
+    }
+
+    frame = frame_alloc(0);
+    if(!frame) {
+        return -1;
+    }
+    memset(frame, 0, PAGE_SIZE);
+    if(paging_map(proc->page_dir, addr & PAGING_ADDR_MASK, (unsigned int)frame,
+                  PAGING_WRITE | PAGING_USER | PAGING_OWNED) == -1) {
+        frame_free(frame);
+        return -1;
+    }
+    return 0;
+}
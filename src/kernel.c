@@ -15,6 +15,10 @@
 #include "vga.h"
 #include "scheduler.h"
 #include "user_prog.h"
+#include "timer.h"
+#include "kmalloc.h"
+#include "frame.h"
+#include "syscall.h"
 // Current log level
 int kernel_log_level;
 proc_t* current = NULL;
@@ -169,6 +173,7 @@ void kernel_panic(char *msg, ...) {
  */
 void kernel_debug_command(unsigned char cmd) {
     int pid;
+    int server;
     int error;
     switch(cmd) {
         case 'b':
@@ -176,11 +181,51 @@ void kernel_debug_command(unsigned char cmd) {
             breakpoint();
             break;
         case 'p':
-            pid = kproc_create(&user_test, "Test", PROC_TYPE_USER);
+            pid = kproc_create(&user_test, "Test", PROC_TYPE_USER, 0);
             if(pid != -1) {
                 kernel_log_trace("process %d created", pid);
             }
             break;
+        case 'e':
+            pid = kproc_create(&user_short, "Short", PROC_TYPE_USER, PROC_STACK_MIN);
+            if(pid != -1) {
+                kernel_log_trace("process %d created", pid);
+            }
+            break;
+        case 'm':
+            kmalloc_stats();
+            frame_stats();
+            break;
+        case 's':
+            pid = kproc_create(&user_syscall_bench, "Bench", PROC_TYPE_USER, 0);
+            if(pid != -1) {
+                kernel_log_trace("process %d created", pid);
+            }
+            break;
+        case 'r':
+            pid = kproc_create(&user_ring_test, "Ring", PROC_TYPE_USER, 0);
+            if(pid != -1) {
+                kernel_log_trace("process %d created", pid);
+            }
+            break;
+        case 'i':
+            // The client gets the pid of the server as its argument
+            server = kproc_create(&user_ipc_server, "Server", PROC_TYPE_USER, 0);
+            if(server == -1) {
+                break;
+            }
+            pid = kproc_create(&user_ipc_client, "Client", PROC_TYPE_USER, 0);
+            if(pid != -1) {
+                pid_to_proc(pid)->trapframe->eax = server;
+                kernel_log_trace("processes %d and %d created", server, pid);
+            }
+            break;
+        case 'c':
+            pid = kproc_clone(current);
+            if(pid != -1) {
+                kernel_log_trace("process %d cloned", pid);
+            }
+            break;
         case 'x':
             error = kproc_destroy(current);
             if(error != -1) {
@@ -273,12 +318,15 @@ void kernel_debug_command(unsigned char cmd) {
 /**
  * Kernel Idle
  * Runs infinitely, ensures interrupts are enabled and the CPU is halted
+ * Spare CPU time is used to prepare zeroed process stacks
  */
 void kernel_idle(void) {
     kernel_log_trace("kernel idle task");
     while(1) {
         interrupts_enable();
-        asm("hlt");
+        if(!kproc_stack_refill()) {
+            asm("hlt");
+        }
     }
 }
 
@@ -293,7 +341,35 @@ void kernel_idle(void) {
  */
 void kernel_context_enter(trapframe_t *trapframe) {
     current->trapframe = trapframe;
-    interrupts_irq_handler(trapframe->interrupt);
+    if(trapframe->interrupt == IRQ_SYSCALL) {
+        // System calls only come from running processes (never the idle
+        // task), and there is no interrupt controller to acknowledge
+        syscall_dispatch(trapframe);
+    } else {
+        timer_tickless_exit(trapframe->interrupt);
+        interrupts_irq_handler(trapframe->interrupt);
+    }
+    // Requests queued in the shared system call ring are handled on
+    // every entry, while the address space of the process is loaded
+    if(current->ring && current->state != ZOMBIE) {
+        syscall_ring_drain();
+    }
+
+    // Catch stack overflows before switching away from the process
+    if(current && kproc_stack_check(current) == -1) {
+        if(current->type == PROC_TYPE_KERNEL) {
+            kernel_panic("Kernel process %s overflowed its stack!", current->name);
+        }
+        kernel_log_error("Process %s (%d) overflowed its stack; killing it",
+                         current->name, current->pid);
+        kproc_destroy(current);
+    }
     scheduler_run();
-    kernel_context_exit(current->trapframe);
+
+    // The idle task only runs when nothing else is runnable, so the
+    // periodic tick can be stopped until the next timer is due
+    if(current->pid == 0) {
+        timer_tickless_enter();
+    }
+    kernel_context_exit(current->trapframe, current->page_dir);
 }
@@ -0,0 +1,173 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Kernel heap allocator
+ *
+ * Each size class is a slab cache of power-of-two objects. Every
+ * allocation starts with a small header recording its class, so kfree
+ * does not need the size and both paths run in constant time.
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "kmalloc.h"
+#include "slab.h"
+
+// Header in front of every allocation (keeps the memory SLAB_ALIGN aligned)
+typedef struct kmalloc_header_t {
+    int class;              // Size class the allocation came from
+    int size;               // Bytes requested
+} kmalloc_header_t;
+
+// Size class caches
+slab_cache_t kmalloc_cache[KMALLOC_CLASSES];
+
+// Size class statistics
+kmalloc_stats_t kmalloc_class_stats[KMALLOC_CLASSES];
+
+// Size class cache names
+char *kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k",
+    "kmalloc-4k", "kmalloc-8k", "kmalloc-16k", "kmalloc-32k"
+};
+
+/**
+ * Finds the size class for an allocation
+ * @param size - number of bytes including the header
+ * @return size class, -1 if the size is invalid or too large
+ */
+static int kmalloc_class(int size) {
+    int shift;
+
+    if(size <= 0) {
+        return -1;
+    }
+    if(size <= (1 << KMALLOC_MIN_SHIFT)) {
+        return 0;
+    }
+    // Index of the highest set bit of size-1 gives the rounded up power of two
+    asm("bsrl %1, %0" : "=r"(shift) : "rm"(size - 1));
+    shift++;
+    if(shift > KMALLOC_MAX_SHIFT) {
+        return -1;
+    }
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+/**
+ * Initializes the kernel heap
+ * Must be called after frame_init()
+ */
+void kmalloc_init(void) {
+    kernel_log_info("Initializing kernel heap");
+
+    for(int i = 0; i < KMALLOC_CLASSES; i++) {
+        slab_cache_init(&kmalloc_cache[i], kmalloc_names[i], 1 << (i + KMALLOC_MIN_SHIFT));
+    }
+    memset(kmalloc_class_stats, 0, sizeof(kmalloc_class_stats));
+}
+
+/**
+ * Allocates memory from the kernel heap
+ * The size is rounded up to a power of two size class; the memory is
+ * not initialized
+ * Must be called with interrupts disabled
+ * @param size - number of bytes
+ * @return pointer to the memory, NULL on error
+ */
+void *kmalloc(int size) {
+    kmalloc_header_t *header;
+    kmalloc_stats_t *stats;
+    int class;
+
+    if(size <= 0) {
+        return NULL;
+    }
+
+    // Checked before adding the header so the sum can not overflow
+    if(size > (1 << KMALLOC_MAX_SHIFT) - (int)sizeof(kmalloc_header_t)) {
+        kernel_log_warn("kmalloc: allocation of %d bytes is too large!", size);
+        return NULL;
+    }
+
+    class = kmalloc_class(size + (int)sizeof(kmalloc_header_t));
+    if(class == -1) {
+        kernel_log_warn("kmalloc: allocation of %d bytes is too large!", size);
+        return NULL;
+    }
+
+    stats = &kmalloc_class_stats[class];
+    header = slab_alloc(&kmalloc_cache[class]);
+    if(!header) {
+        stats->failed++;
+        return NULL;
+    }
+    header->class = class;
+    header->size = size;
+
+    stats->allocs++;
+    stats->inuse++;
+    stats->requested += size;
+    if(stats->inuse > stats->peak) {
+        stats->peak = stats->inuse;
+    }
+    return header + 1;
+}
+
+/**
+ * Returns memory to the kernel heap
+ * Must be called with interrupts disabled
+ * @param ptr - pointer returned by kmalloc (NULL is ignored)
+ */
+void kfree(void *ptr) {
+    kmalloc_header_t *header;
+    kmalloc_stats_t *stats;
+
+    if(!ptr) {
+        return;
+    }
+
+    header = (kmalloc_header_t *)ptr - 1;
+    if(header->class < 0 || header->class >= KMALLOC_CLASSES) {
+        kernel_log_error("kfree: invalid pointer %p!", ptr);
+        return;
+    }
+
+    stats = &kmalloc_class_stats[header->class];
+    stats->frees++;
+    stats->inuse--;
+    stats->requested -= header->size;
+    slab_free(&kmalloc_cache[header->class], header);
+}
+
+/**
+ * Gets the usage statistics for a size class
+ * @param class - size class (0 to KMALLOC_CLASSES-1)
+ * @return pointer to the statistics, NULL if the class is invalid
+ */
+kmalloc_stats_t *kmalloc_get_stats(int class) {
+    if(class < 0 || class >= KMALLOC_CLASSES) {
+        return NULL;
+    }
+    return &kmalloc_class_stats[class];
+}
+
+/**
+ * Logs the usage statistics of every size class that has been used
+ */
+void kmalloc_stats(void) {
+    for(int i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_stats_t *stats = &kmalloc_class_stats[i];
+        if(stats->allocs == 0) {
+            continue;
+        }
+        // Waste is the space lost to rounding up to the size class
+        kernel_log_info("%s: inuse=%d peak=%d allocs=%d frees=%d failed=%d slabs=%d waste=%d",
+                        kmalloc_names[i], stats->inuse, stats->peak, stats->allocs,
+                        stats->frees, stats->failed, kmalloc_cache[i].slabs,
+                        stats->inuse * (1 << (i + KMALLOC_MIN_SHIFT)) - stats->requested);
+    }
+}
@@ -15,35 +15,175 @@
 #include "kproc.h"
 #include "scheduler.h"
 #include "timer.h"
-#include "queue.h"
+#include "slab.h"
 #include "vga.h"
+#include "interrupts.h"
+#include "frame.h"
+#include "gdt.h"
+#include "user_prog.h"
+#include "syscall.h"
+#include "clock.h"
+#include "ipc.h"
+#include "sync.h"
 
 #define LINE_WIDTH 55
 
-// Next available process id to be assigned
-int next_pid;
+// Number of stack size classes (powers of two from PROC_STACK_MIN to PROC_STACK_MAX)
+#define PROC_STACK_CLASSES 7
 
-// Process table allocator
-queue_t proc_allocator;
+#if (PROC_STACK_MIN << (PROC_STACK_CLASSES - 1)) != PROC_STACK_MAX
+#error "PROC_STACK_CLASSES does not match PROC_STACK_MIN and PROC_STACK_MAX"
+#endif
 
-// Process table
-proc_t proc_table[PROC_MAX];
+// Generation counter for each process table entry
+int proc_generation[PROC_MAX];
 
-// Process stacks
-unsigned char proc_stack[PROC_MAX][PROC_STACK_SIZE];
+// Process table allocator; stack of free process table entries
+int proc_free_entries[PROC_MAX];
+int proc_free_count;
+
+// Process table; each entry points to a slab-allocated process control block
+proc_t *proc_table[PROC_MAX];
+
+// Process control block cache
+slab_cache_t proc_cache;
+
+// Process stack caches, one per stack size class
+slab_cache_t proc_stack_cache[PROC_STACK_CLASSES];
+
+// Processes waiting to be reaped
+proc_queue_t proc_zombies;
+
+// One unit per process waiting to be reaped
+semaphore_t proc_zombies_ready;
+
+// Reaper process; releases the resources of zombie processes
+proc_t *proc_reaper;
+
+// Stack pool for one stack size class
+// Stacks are linked through their first word
+typedef struct proc_stack_pool_t {
+    void *clean;            // Zeroed stacks, ready for a new process
+    int clean_count;        // Number of zeroed stacks
+    void *dirty;            // Stacks of destroyed processes, still to be zeroed
+} proc_stack_pool_t;
+
+// Stack pools, one per stack size class
+proc_stack_pool_t proc_stack_pool[PROC_STACK_CLASSES];
+
+/**
+ * Finds the stack size class for a requested stack size
+ * @param stack_size - requested stack size
+ * @return stack size class, -1 if the size is too large
+ */
+static int kproc_stack_class(int stack_size) {
+    int size = PROC_STACK_MIN;
+
+    for(int i = 0; i < PROC_STACK_CLASSES; i++, size <<= 1) {
+        if(stack_size <= size) {
+            return i;
+        }
+    }
+    return -1;
+}
 
 /**
  * Looks up a process in the process table via the process id
+ * Runs in constant time; stale pids of freed processes are rejected
  * @param pid - process id
  * @return pointer to the process entry, NULL or error or if not found
  */
 proc_t *pid_to_proc(int pid) {
-    for(int i = 0; i < PROC_MAX; i++) {
-        if(proc_table[i].pid == pid) {
-            return &proc_table[i];
-        }
+    int slot = pid & PROC_PID_SLOT_MASK;
+
+    if(pid < 0 || slot >= PROC_MAX) {
+        return NULL;
+    }
+
+    // Only the pid of the live process in this entry (with the current
+    // generation) can match; zombies can no longer be looked up
+    if(!proc_table[slot] || proc_table[slot]->pid != pid || proc_table[slot]->state == ZOMBIE) {
+        return NULL;
+    }
+    return proc_table[slot];
+}
+
+/**
+ * Initializes a process queue
+ * @param queue - pointer to the process queue
+ */
+void proc_queue_init(proc_queue_t *queue) {
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->size = 0;
+}
+
+/**
+ * Adds a process to the tail of a process queue
+ * @param queue - pointer to the process queue
+ * @param proc - process entry (must not be in another queue)
+ * @return 0 on success, -1 on error
+ */
+int proc_queue_in(proc_queue_t *queue, proc_t *proc) {
+    if(!queue || !proc || proc->queue) {
+        kernel_log_error("Unable to add process to queue!");
+        return -1;
+    }
+
+    proc->queue = queue;
+    proc->next = NULL;
+    proc->prev = queue->tail;
+    if(queue->tail) {
+        queue->tail->next = proc;
+    } else {
+        queue->head = proc;
+    }
+    queue->tail = proc;
+    queue->size++;
+    return 0;
+}
+
+/**
+ * Removes the process at the head of a process queue
+ * @param queue - pointer to the process queue
+ * @return pointer to the process entry, NULL if the queue is empty
+ */
+proc_t *proc_queue_out(proc_queue_t *queue) {
+    proc_t *proc = queue->head;
+    if(proc) {
+        proc_queue_remove(queue, proc);
+    }
+    return proc;
+}
+
+/**
+ * Removes a process from anywhere in the process queue
+ * @param queue - pointer to the process queue
+ * @param proc - process entry
+ * @return 0 on success, -1 if the process is not in the queue
+ */
+int proc_queue_remove(proc_queue_t *queue, proc_t *proc) {
+    if(!queue || !proc || proc->queue != queue) {
+        return -1;
+    }
+
+    //unlink from the neighbours (or the queue ends)
+    if(proc->prev) {
+        proc->prev->next = proc->next;
+    } else {
+        queue->head = proc->next;
+    }
+    if(proc->next) {
+        proc->next->prev = proc->prev;
+    } else {
+        queue->tail = proc->prev;
     }
-    return NULL;
+
+    proc->queue = NULL;
+    proc->next = NULL;
+    proc->prev = NULL;
+    queue->size--;
+    return 0;
 }
 
 void displayProcs() {
@@ -63,15 +203,31 @@ void displayProcs() {
         }
     }
 
-    //buffer all running and idle process info
-    snprintf(buff, sizeof(line) - 1, "%s%8s%10s%15s%15s\n", "ENTRY", "PID", "STATE", "TIME", "NAME");
-    for(int i = 0; i < PROC_MAX; i++) {
-        if(proc_table[i].state == IDLE || proc_table[i].state == RUNNING) {
-            snprintf(line, sizeof(line) - 1, "%5d%8d%10c%15d%15s\n",
-                     i, proc_table[i].pid, (proc_table[i].state == IDLE ? 'I' : 'R'),
-                     proc_table[i].run_time, proc_table[i].name);
-            strcat(buff, line);
+    //buffer all running and idle process info (as many as fit on the display)
+    snprintf(buff, sizeof(line) - 1, "%s%8s%6s%10s%9s%15s\n", "ENTRY", "PID", "STATE", "TIME", "STACK", "NAME");
+    for(int i = 0, lines = 0; i < PROC_MAX && lines < 10; i++) {
+        char name[PROC_NAME_LEN];
+        int pid, run_time, stack;
+        state_t state = NONE;
+        // This runs in the kernel worker with interrupts enabled, so the
+        // process may be released at any time; copy what is displayed
+        // while interrupts are disabled
+        int flags = interrupts_save();
+        proc_t *proc = proc_table[i];
+        if(proc && (proc->state == IDLE || proc->state == RUNNING)) {
+            state = proc->state;
+            pid = proc->pid;
+            run_time = proc->run_time;
+            stack = kproc_stack_usage(proc);
+            strncpy(name, proc->name, PROC_NAME_LEN);
+        }
+        interrupts_restore(flags);
 
+        if(state != NONE) {
+            snprintf(line, sizeof(line) - 1, "%5d%8d%6c%10d%9d%15s\n",
+                     i, pid, (state == IDLE ? 'I' : 'R'), run_time, stack, name);
+            strcat(buff, line);
+            lines++;
         }
     }
 
@@ -90,6 +246,252 @@ void displayProcs() {
 
 }
 
+/**
+ * Takes a zeroed stack for a new process
+ * Uses the pool of pre-zeroed stacks when possible so that creating
+ * a process does not have to clear the whole stack
+ * Must be called with interrupts disabled
+ * @param stack_class - stack size class
+ * @return pointer to the zeroed stack, NULL if out of memory
+ */
+static unsigned char *kproc_stack_alloc(int stack_class) {
+    proc_stack_pool_t *pool = &proc_stack_pool[stack_class];
+    unsigned char *stack;
+
+    if(pool->clean) {
+        stack = pool->clean;
+        pool->clean = *(void **)stack;
+        pool->clean_count--;
+        // Only the link word was written after the stack was zeroed
+        *(void **)stack = NULL;
+        return stack;
+    }
+
+    // Pool is empty; fall back to zeroing a stack here
+    stack = slab_alloc(&proc_stack_cache[stack_class]);
+    if(stack) {
+        memset(stack, 0, PROC_STACK_MIN << stack_class);
+    }
+    return stack;
+}
+
+/**
+ * Returns the stack of a destroyed process to its pool
+ * The stack is zeroed later by the idle task
+ * Must be called with interrupts disabled
+ * @param stack_class - stack size class
+ * @param stack - pointer to the stack
+ */
+static void kproc_stack_free(int stack_class, unsigned char *stack) {
+    proc_stack_pool_t *pool = &proc_stack_pool[stack_class];
+
+    *(void **)stack = pool->dirty;
+    pool->dirty = stack;
+}
+
+/**
+ * Performs one step of background stack maintenance: zeroes one freed
+ * stack, or tops up the pool of pre-zeroed default size stacks
+ * Called by the idle task with interrupts enabled
+ * @return 1 if work was done, 0 if there is nothing left to do
+ */
+int kproc_stack_refill(void) {
+    proc_stack_pool_t *pool = NULL;
+    unsigned char *stack = NULL;
+    int stack_class;
+
+    // Detach one stack from the pools while interrupts are disabled
+    interrupts_disable();
+    for(stack_class = 0; stack_class < PROC_STACK_CLASSES; stack_class++) {
+        pool = &proc_stack_pool[stack_class];
+        if(pool->dirty) {
+            stack = pool->dirty;
+            pool->dirty = *(void **)stack;
+            break;
+        }
+    }
+    if(!stack) {
+        stack_class = kproc_stack_class(PROC_STACK_SIZE);
+        pool = &proc_stack_pool[stack_class];
+        if(pool->clean_count < PROC_STACK_POOL) {
+            stack = slab_alloc(&proc_stack_cache[stack_class]);
+        }
+    }
+    interrupts_enable();
+
+    if(!stack) {
+        return 0;
+    }
+
+    // The stack belongs to no one, so it can be zeroed with interrupts enabled
+    memset(stack, 0, PROC_STACK_MIN << stack_class);
+
+    interrupts_disable();
+    if(pool->clean_count < PROC_STACK_POOL) {
+        *(void **)stack = pool->clean;
+        pool->clean = stack;
+        pool->clean_count++;
+    } else {
+        // Pool is full; keep the memory in the cache for other uses
+        slab_free(&proc_stack_cache[stack_class], stack);
+    }
+    interrupts_enable();
+    return 1;
+}
+
+/**
+ * Checks the canary words at the base of a process stack
+ * @param proc - process entry
+ * @return 0 if the canary is intact, -1 if the stack overflowed
+ */
+int kproc_stack_check(proc_t *proc) {
+    unsigned int *canary = (unsigned int *)proc->stack;
+
+    // User process stacks are protected by their guard page instead
+    if(proc->page_dir != paging_kernel_dir) {
+        return 0;
+    }
+
+    for(int i = 0; i < PROC_STACK_CANARY_WORDS; i++) {
+        if(canary[i] != PROC_STACK_CANARY) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Updates and returns the stack high-water mark of a process
+ * Stacks start out zeroed, so the lowest non-zero word marks the
+ * deepest point the stack has reached. Only the part of the stack
+ * below the previous mark is scanned
+ * @param proc - process entry
+ * @return deepest stack usage seen so far (bytes)
+ */
+int kproc_stack_usage(proc_t *proc) {
+    unsigned int *stack = (unsigned int *)proc->stack;
+    int end = (proc->stack_size - proc->stack_peak) / sizeof(unsigned int);
+
+    // User process stacks are only mapped as deep as they have been used
+    if(proc->page_dir != paging_kernel_dir) {
+        return proc->stack_pages * PAGE_SIZE;
+    }
+
+    for(int i = PROC_STACK_CANARY_WORDS; i < end; i++) {
+        if(stack[i] != 0) {
+            proc->stack_peak = proc->stack_size - i * sizeof(unsigned int);
+            break;
+        }
+    }
+    return proc->stack_peak;
+}
+
+/**
+ * Releases the process table entry, stack and process control block
+ * of a zombie process
+ * Must be called with interrupts disabled
+ * @param proc - process entry
+ */
+static void kproc_release(proc_t *proc) {
+    int entryId = proc->pid & PROC_PID_SLOT_MASK;
+
+    // Advance the entry generation so the old pid can no longer be looked up
+    proc_generation[entryId] = (proc_generation[entryId] + 1) & PROC_PID_GEN_MASK;
+
+    // Release the address space (including a user stack), kernel stack
+    // and process control block
+    if(proc->page_dir != paging_kernel_dir) {
+        paging_dir_destroy(proc->page_dir);
+    } else {
+        kproc_stack_free(kproc_stack_class(proc->stack_size), proc->stack);
+    }
+    slab_free(&proc_cache, proc);
+
+    // Add the proc table entry back to the process allocator (to be recycled)
+    proc_table[entryId] = NULL;
+    proc_free_entries[proc_free_count++] = entryId;
+}
+
+/**
+ * Reaper process
+ * Releases zombie processes in batches with interrupts enabled in
+ * between, and blocks when there are none left
+ */
+void kproc_reaper(void) {
+    while(1) {
+        semaphore_wait(&proc_zombies_ready);
+
+        interrupts_disable();
+        kproc_release(proc_queue_out(&proc_zombies));
+        for(int i = 1; i < PROC_REAP_BATCH && semaphore_trywait(&proc_zombies_ready) == 0; i++) {
+            kproc_release(proc_queue_out(&proc_zombies));
+        }
+        interrupts_enable();
+    }
+}
+
+/**
+ * Turns the current process into a zombie
+ * The process stays current (and on its stack) until the scheduler
+ * next switches away from it; the reaper cannot run before then
+ * Must be called with interrupts disabled
+ */
+void kproc_exit_current(void) {
+    if(current->pid == 0) {
+        kernel_log_error("Idle task cannot exit!");
+        return;
+    }
+    ipc_exit(current);
+    current->state = ZOMBIE;
+    proc_queue_in(&proc_zombies, current);
+    semaphore_post(&proc_zombies_ready);
+}
+
+/**
+ * Exit trampoline
+ * Every process returns here when its entry function returns. The
+ * process becomes a zombie and never runs again
+ */
+void kproc_exit(void) {
+    interrupts_disable();
+    kproc_exit_current();
+
+    // A zombie is never scheduled again
+    while(1) {
+        scheduler_switch();
+    }
+}
+
+/**
+ * Maps a new page into a user process stack after a page fault
+ * @param proc - process entry
+ * @param addr - faulting address
+ * @return 0 on success, -1 if the address is outside the stack limit
+ *         or there is no memory
+ */
+int kproc_stack_grow(proc_t *proc, unsigned int addr) {
+    void *frame;
+
+    // Addresses below the limit (starting with the guard page) are not stack
+    if(proc->page_dir == paging_kernel_dir ||
+       addr < (unsigned int)proc->stack || addr >= PROC_USTACK_TOP) {
+        return -1;
+    }
+
+    frame = frame_alloc(0);
+    if(!frame) {
+        return -1;
+    }
+    memset(frame, 0, PAGE_SIZE);
+    if(paging_map(proc->page_dir, addr & PAGING_ADDR_MASK, (unsigned int)frame,
+                  PAGING_WRITE | PAGING_USER | PAGING_OWNED) == -1) {
+        frame_free(frame);
+        return -1;
+    }
+    proc->stack_pages++;
+    return 0;
+}
+
 /**
  * Initializes all process related data structures
  * Creates the first process (kernel_idle)
@@ -97,24 +499,40 @@ void displayProcs() {
  */
 void kproc_init(void) {
     kernel_log_info("Initializing process table");
-    next_pid = 0;
-    // Initialize the process allocator
-    queue_init(&proc_allocator);
+    memset(proc_generation, 0, sizeof(proc_generation));
+    // Initialize the process allocator (entry 0 is handed out first)
     for(int i = 0; i < PROC_MAX; i++) {
-        if(queue_in(&proc_allocator, i) == -1) {
-            kernel_log_error("Couldn't queue another pid!");
-        }
+        proc_free_entries[i] = PROC_MAX - 1 - i;
     }
+    proc_free_count = PROC_MAX;
     // Initialize the process table
-    memset(proc_table, 0, sizeof(proc_t)*PROC_MAX);
-    // Initialize the process stacks
-    memset(proc_stack, 0, PROC_MAX * PROC_STACK_SIZE);
+    memset(proc_table, 0, sizeof(proc_table));
+    // Initialize the process control block and stack caches; memory is
+    // only allocated as processes are created
+    slab_cache_init(&proc_cache, "proc", sizeof(proc_t));
+    for(int i = 0; i < PROC_STACK_CLASSES; i++) {
+        slab_cache_init(&proc_stack_cache[i], "stack", PROC_STACK_MIN << i);
+    }
+    // Stack pools start empty and are filled by the idle task
+    memset(proc_stack_pool, 0, sizeof(proc_stack_pool));
     // Create the idle task as a kernel process
     kernel_log_info("Launching the idle task");
-    kproc_create(kernel_idle, "idle", PROC_TYPE_KERNEL);
+    kproc_create(kernel_idle, "idle", PROC_TYPE_KERNEL, 0);
+
+    // Create the reaper; releasing exited processes is not urgent, so
+    // it only runs when nothing else needs the CPU
+    proc_queue_init(&proc_zombies);
+    semaphore_init(&proc_zombies_ready, 0);
+    proc_reaper = pid_to_proc(kproc_create(kproc_reaper, "reaper", PROC_TYPE_KERNEL, PROC_STACK_MIN * 2));
+    if(!proc_reaper) {
+        kernel_panic("Unable to start the reaper!");
+    }
+    scheduler_set_priority(proc_reaper, SCHEDULER_PRIO_LEVELS - 1);
 
     // Add a timer callback that displays the status of all processes that have been created
-    timer_callback_register(&displayProcs, 1, -1);
+    // The display only needs refreshing when something runs, so it does not wake the idle task
+    int id = timer_callback_register(&displayProcs, 1, -1, 0);
+    timer_callback_set_flags(id, TIMER_FLAG_DEFERRABLE);
 }
 
 /**
@@ -122,83 +540,265 @@ void kproc_init(void) {
  * @param proc_ptr - address of process to execute
  * @param proc_name - "friendly" process name
  * @param proc_type - process type (kernel or user)
+ * @param stack_size - stack size in bytes (rounded up to a power of two
+ *                     between PROC_STACK_MIN and PROC_STACK_MAX), or 0
+ *                     for PROC_STACK_SIZE
  * @return process id of the created process, -1 on error
  */
-int kproc_create(void *proc_ptr, char *proc_name, proc_type_t proc_type) {
+int kproc_create(void *proc_ptr, char *proc_name, proc_type_t proc_type, int stack_size) {
+    proc_t *proc;
+    unsigned char *stack_top;
+    trapframe_t *trapframe;
+    int stack_class;
+    int entryId;
+
+    // Find the stack size class
+    if(stack_size <= 0) {
+        stack_size = PROC_STACK_SIZE;
+    }
+    stack_class = kproc_stack_class(stack_size);
+    if(stack_class == -1) {
+        kernel_log_warn("Process creation failed: stack size %d too large!", stack_size);
+        return -1;
+    }
+
     // Allocate the PCB entry for the process from the process allocator
     //kernel_log_trace("kproc_create()");
-    int entryId;
-    if(queue_out(&proc_allocator, &entryId) == -1){
+    if(proc_free_count == 0){
         kernel_log_warn("Process creation failed: at limit!");
         return -1;
     }
+
+    // Allocate the PCB
+    proc = slab_alloc(&proc_cache);
+    if(!proc) {
+        kernel_log_warn("Process creation failed: out of memory!");
+        return -1;
+    }
     // Initialize the PCB entry for the process
-    memset(&proc_table[entryId], 0, sizeof(proc_t));
-    // Set the stack pointer for the process within proc_stack
-    proc_table[entryId].stack = proc_stack[entryId];
-    // Initialize the stack
-    memset(proc_table[entryId].stack, 0, PROC_STACK_SIZE);
-    // Set the pid to a unique value (next_pid)
-    proc_table[entryId].pid = next_pid;
-    next_pid++;
+    memset(proc, 0, sizeof(proc_t));
+    proc->stack_size = PROC_STACK_MIN << stack_class;
+
+    if(proc_type == PROC_TYPE_USER) {
+        // User processes get their own address space, with only the top
+        // page of the stack mapped; the stack is accessed here through
+        // the identity mapping of that page
+        if(proc->stack_size < PAGE_SIZE) {
+            proc->stack_size = PAGE_SIZE;
+        }
+        proc->page_dir = paging_dir_create();
+        stack_top = frame_alloc(0);
+        if(!proc->page_dir || !stack_top ||
+           paging_map(proc->page_dir, PROC_USTACK_TOP - PAGE_SIZE, (unsigned int)stack_top,
+                      PAGING_WRITE | PAGING_USER | PAGING_OWNED) == -1) {
+            paging_dir_destroy(proc->page_dir);
+            frame_free(stack_top);
+            slab_free(&proc_cache, proc);
+            kernel_log_warn("Process creation failed: out of memory!");
+            return -1;
+        }
+        // Once mapped, the stack frame is owned (and freed) by the directory
+        if(paging_map(proc->page_dir, CLOCK_PAGE_ADDR, (unsigned int)clock_page, PAGING_USER) == -1) {
+            paging_dir_destroy(proc->page_dir);
+            slab_free(&proc_cache, proc);
+            kernel_log_warn("Process creation failed: out of memory!");
+            return -1;
+        }
+        memset(stack_top, 0, PAGE_SIZE);
+        stack_top += PAGE_SIZE;
+        proc->stack = (unsigned char *)(PROC_USTACK_TOP - proc->stack_size);
+        proc->stack_pages = 1;
+    } else {
+        // Kernel processes share the kernel address space and get their
+        // whole stack up front
+        proc->page_dir = paging_kernel_dir;
+        proc->stack = kproc_stack_alloc(stack_class);
+        if(!proc->stack) {
+            slab_free(&proc_cache, proc);
+            kernel_log_warn("Process creation failed: out of memory!");
+            return -1;
+        }
+        stack_top = proc->stack + proc->stack_size;
+        // Guard the stack base so overflows can be detected
+        for(int i = 0; i < PROC_STACK_CANARY_WORDS; i++) {
+            ((unsigned int *)proc->stack)[i] = PROC_STACK_CANARY;
+        }
+    }
+
+    entryId = proc_free_entries[--proc_free_count];
+    proc_table[entryId] = proc;
+
+    // Set the pid to a unique value (entry and its generation)
+    proc->pid = (proc_generation[entryId] << PROC_PID_SLOT_BITS) | entryId;
     // Initialize process control block variables to default values
-    proc_table[entryId].state = NONE;
-    proc_table[entryId].type = proc_type;
-    proc_table[entryId].start_time = timer_get_system_time();
-    proc_table[entryId].run_time = 0;
-    proc_table[entryId].cpu_time = 0;
+    proc->state = NONE;
+    proc->type = proc_type;
+    proc->priority = SCHEDULER_PRIO_DEFAULT;
+    proc->base_priority = SCHEDULER_PRIO_DEFAULT;
+    proc->start_time = timer_get_system_time();
+    proc->run_time = 0;
+    proc->cpu_time = 0;
     // Copy the process name to the PCB
-    strncpy(proc_table[entryId].name, proc_name, PROC_NAME_LEN - 1);
-    // Allocate the trapframe pointer at the top of the stack (initially empty, so the bottom, effectively)
-    // proc->trapframe = (trapframe_t *)(&proc->stack[PROC_STACK_SIZE - sizeof(trapframe_t)]);
-    proc_table[entryId].trapframe = (trapframe_t*)(&proc_table[entryId].stack[PROC_STACK_SIZE - sizeof(trapframe_t)]);
-    // Allocate the trapframe data:
-    //   eip     = proc_ptr
-    //   eflags  = EF_DEFAULT_VALUE | EF_INTR
-    //   cs      = get_cs()
-    //   ds      = get_ds()
-    //   es      = get_es()
-    //   fs      = get_fs()
-    //   gs      = get_gs()
-    proc_table[entryId].trapframe->eip = (unsigned int)proc_ptr;
-    proc_table[entryId].trapframe->eflags = EF_DEFAULT_VALUE | EF_INTR;
-    proc_table[entryId].trapframe->cs = get_cs();
-    proc_table[entryId].trapframe->ds = get_ds();
-    proc_table[entryId].trapframe->es = get_es();
-    proc_table[entryId].trapframe->fs = get_fs();
-    proc_table[entryId].trapframe->gs = get_gs();
+    strncpy(proc->name, proc_name, PROC_NAME_LEN - 1);
+    if(proc_type == PROC_TYPE_USER) {
+        // The entry function returns to the user exit stub, which asks
+        // the kernel to end the process
+        *(unsigned int *)(stack_top - sizeof(unsigned int)) = (unsigned int)user_exit;
+        // The ring 3 state is kept in the PCB: interrupts from ring 3
+        // switch to the stack in the TSS, which ends at this trapframe
+        trapframe = &proc->user_frame;
+        proc->trapframe = trapframe;
+        // Allocate the trapframe data:
+        //   eip      = proc_ptr
+        //   eflags   = EF_DEFAULT_VALUE | EF_INTR
+        //   cs       = user code segment
+        //   ds .. gs = user data segment
+        //   user_esp = top of the stack, below the return address
+        trapframe->eip = (unsigned int)proc_ptr;
+        trapframe->eflags = EF_DEFAULT_VALUE | EF_INTR;
+        trapframe->cs = UCODE_SEL;
+        trapframe->ds = UDATA_SEL;
+        trapframe->es = UDATA_SEL;
+        trapframe->fs = UDATA_SEL;
+        trapframe->gs = UDATA_SEL;
+        trapframe->user_ss = UDATA_SEL;
+        trapframe->user_esp = PROC_USTACK_TOP - sizeof(unsigned int);
+        proc->stack_peak = sizeof(unsigned int);
+    } else {
+        // The entry function returns to the exit trampoline
+        *(unsigned int *)(stack_top - sizeof(unsigned int)) = (unsigned int)kproc_exit;
+        // Allocate the trapframe at the top of the stack, below the return
+        // address; ring 0 interrupts do not push user_esp and user_ss
+        trapframe = (trapframe_t*)(stack_top - sizeof(unsigned int) - TRAPFRAME_KERNEL_SIZE);
+        proc->trapframe = trapframe;
+        // Allocate the trapframe data:
+        //   eip     = proc_ptr
+        //   eflags  = EF_DEFAULT_VALUE | EF_INTR
+        //   cs      = get_cs()
+        //   ds      = get_ds()
+        //   es      = get_es()
+        //   fs      = get_fs()
+        //   gs      = get_gs()
+        trapframe->eip = (unsigned int)proc_ptr;
+        trapframe->eflags = EF_DEFAULT_VALUE | EF_INTR;
+        trapframe->cs = get_cs();
+        trapframe->ds = get_ds();
+        trapframe->es = get_es();
+        trapframe->fs = get_fs();
+        trapframe->gs = get_gs();
+        proc->stack_peak = sizeof(unsigned int) + TRAPFRAME_KERNEL_SIZE;
+    }
 
     // Add the process to the scheduler
-    scheduler_add(&proc_table[entryId]);
+    scheduler_add(proc);
 
-    //kernel_log_info("Created process %s (%d) entry=%d", proc_name, proc_table[entryId].pid, entryId);
+    //kernel_log_info("Created process %s (%d) entry=%d", proc_name, proc->pid, entryId);
 
     // Return the process id for the newly created process
-    return proc_table[entryId].pid;
+    return proc->pid;
+}
+
+/**
+ * Clones a user process
+ * The clone gets a copy on write duplicate of the address space and
+ * resumes from the same saved state as the original. Only the page
+ * tables are copied here; pages are copied as either process writes them
+ * Must be called with interrupts disabled
+ * @param proc - process entry of the user process to clone
+ * @return process id of the clone, -1 on error
+ */
+int kproc_clone(proc_t *proc) {
+    proc_t *clone;
+    int entryId;
+
+    if(!proc || proc->type != PROC_TYPE_USER || proc->state == ZOMBIE) {
+        kernel_log_warn("Process clone failed: not a user process!");
+        return -1;
+    }
+    if(proc_free_count == 0){
+        kernel_log_warn("Process clone failed: at limit!");
+        return -1;
+    }
+
+    clone = slab_alloc(&proc_cache);
+    if(!clone) {
+        kernel_log_warn("Process clone failed: out of memory!");
+        return -1;
+    }
+    memset(clone, 0, sizeof(proc_t));
+    clone->page_dir = paging_dir_clone(proc->page_dir);
+    if(!clone->page_dir) {
+        slab_free(&proc_cache, clone);
+        kernel_log_warn("Process clone failed: out of memory!");
+        return -1;
+    }
+    // The kernel writes completions to the system call ring through its
+    // frame, so the clone gets its own copy of the ring page right away
+    if(proc->ring) {
+        if(paging_cow_fault(clone->page_dir, SYSCALL_RING_ADDR) == -1) {
+            paging_dir_destroy(clone->page_dir);
+            slab_free(&proc_cache, clone);
+            kernel_log_warn("Process clone failed: out of memory!");
+            return -1;
+        }
+        clone->ring = (syscall_ring_t *)(*paging_get_pte(clone->page_dir, SYSCALL_RING_ADDR) & PAGING_ADDR_MASK);
+    }
+
+    entryId = proc_free_entries[--proc_free_count];
+    proc_table[entryId] = clone;
+
+    // The stack and saved state are at the same virtual addresses in the
+    // duplicated address space
+    clone->pid = (proc_generation[entryId] << PROC_PID_SLOT_BITS) | entryId;
+    clone->state = NONE;
+    clone->type = proc->type;
+    clone->priority = proc->base_priority;
+    clone->base_priority = proc->base_priority;
+    clone->start_time = timer_get_system_time();
+    strncpy(clone->name, proc->name, PROC_NAME_LEN - 1);
+    clone->stack = proc->stack;
+    clone->stack_size = proc->stack_size;
+    clone->stack_pages = proc->stack_pages;
+    clone->stack_peak = proc->stack_peak;
+    clone->user_frame = proc->user_frame;
+    clone->trapframe = &clone->user_frame;
+
+    scheduler_add(clone);
+    return clone->pid;
 }
 
 /**
  * Destroys a process
- * If the process is currently scheduled it must be unscheduled
+ * The process is unscheduled immediately; its process table entry
+ * and stack are released later by the reaper process
+ * Must be called with interrupts disabled
  * @param proc - process control block
  * @return 0 on success, -1 on error
  */
 int kproc_destroy(proc_t *proc) {
+    if(proc->state == ZOMBIE) {
+        return 0;
+    }
     if(proc->pid == 0) {
         kernel_log_error("Cannot destroy idle task!");
         return -1;
     }
-    // Remove the process from the scheduler
-    scheduler_remove(proc);
-
-    // Clear all data structures associated with the process (proc_stack, proc_table)
-    memset(proc->stack, 0, sizeof(PROC_STACK_SIZE));
-    memset(proc, 0, sizeof(proc_t));
-
-    // Add the proc table entry back to the process queue (to be recycled)
-    if(queue_in(&proc_allocator, proc - proc_table) == -1) {
-        kernel_log_error("Unable to deallocate process with pid %d", proc->pid);
+    if(proc->type == PROC_TYPE_KERNEL) {
+        kernel_log_error("Cannot destroy kernel process %s!", proc->name);
+        return -1;
     }
+    // Remove the process from the scheduler (or the queue it is waiting in)
+    if(proc == current || proc->state != BLOCKED) {
+        scheduler_remove(proc);
+    } else if(proc->queue) {
+        proc_queue_remove(proc->queue, proc);
+    }
+
+    // Fail the messages waiting on the process, then hand it over to
+    // the reaper
+    ipc_exit(proc);
+    proc->state = ZOMBIE;
+    proc_queue_in(&proc_zombies, proc);
+    semaphore_post(&proc_zombies_ready);
     return 0;
 }
-
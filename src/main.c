@@ -11,6 +11,14 @@
 #include "interrupts.h"
 #include "timer.h"
 #include "scheduler.h"
+#include "clock.h"
+#include "workqueue.h"
+#include "frame.h"
+#include "gdt.h"
+#include "syscall.h"
+#include "paging.h"
+#include "kmalloc.h"
+#include "futex.h"
 #include <spede/string.h>
 #include <spede/stdio.h>
 
@@ -29,7 +37,7 @@ void uptime(void) {
     char buf[12] = {0};
     int buflen = 0;
 
-    snprintf(buf, sizeof(buf) - 1, "%d", timer_get_system_time() / 100);
+    snprintf(buf, sizeof(buf) - 1, "%u", (unsigned int)clock_div64(clock_get_ns(), CLOCK_NS_PER_SEC, NULL));
     buflen = strlen(buf);
 
     for(int i = 0; i < buflen; i++){
@@ -46,20 +54,40 @@ int main(void) {
     kernel_init();
     // Initialize interrupts
     interrupts_init();
+    // Load the kernel descriptor tables
+    gdt_init();
     // Initialize timer
     timer_init();
+    // Initialize the clocksource
+    clock_init();
     // Initialize the VGA driver
     vga_init();
     // Initialize the keyboard driver
     keyboard_init();
     // Initialize scheduler
     scheduler_init();
+    // Initialize the page frame allocator
+    frame_init();
+    // Enable paging
+    paging_init();
+    // Share the clock with user processes
+    clock_page_init();
+    // Initialize the kernel heap
+    kmalloc_init();
     // Initialize process control
     kproc_init();
+    // Initialize deferred work
+    workqueue_init();
+    // Initialize system calls
+    syscall_init();
+    // Initialize futexes
+    futex_init();
 
 
-    timer_callback_register(&spinner, 10, -1);
-    timer_callback_register(&uptime, 100, -1);
+    // The spinner is cosmetic, so it does not need to wake the idle task
+    int id = timer_callback_register(&spinner, 10, -1, 5);
+    timer_callback_set_flags(id, TIMER_FLAG_DEFERRABLE);
+    timer_callback_register(&uptime, 100, -1, 10);
 
     // Test video output
     /*for (int bg = 0; bg <= 0x7; bg++) {
@@ -74,7 +102,7 @@ int main(void) {
     keyboard_getc();
     vga_set_xy(0, 12);
     scheduler_run();
-    kernel_context_exit(current->trapframe);
+    kernel_context_exit(current->trapframe, current->page_dir);
     // Should never get here
     return 0;
 }
@@ -0,0 +1,441 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Paging and address spaces
+ *
+ * Physical memory is identity mapped with 4MB global pages, so the
+ * kernel can reach every frame (including page tables) by its physical
+ * address, and its TLB entries survive the CR3 load on a context switch.
+ * Each process has its own page directory; only the directory entries
+ * for the user region differ between processes.
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "interrupts.h"
+#include "paging.h"
+#include "frame.h"
+#include "gdt.h"
+#include "user_prog.h"
+#include "ipc.h"
+
+// Control register bits
+#define CR0_WP      0x00010000  // Write protect (applies to ring 0 too)
+#define CR0_PG      0x80000000  // Paging enable
+#define CR4_PSE     0x00000010  // 4MB pages
+#define CR4_PGE     0x00000080  // Global pages
+
+// Kernel page directory (used by kernel processes)
+pde_t *paging_kernel_dir;
+
+// Page fault task state and stack
+tss_t paging_fault_tss;
+unsigned char paging_fault_stack[PAGE_SIZE];
+
+// Kernel stack (context.S)
+extern char kstack[];
+
+// Page fault task entry (context.S)
+extern void isr_entry_page_fault(void);
+
+// Number of directory entries covered by the kernel mapping
+#define PAGING_KERNEL_ENTRIES ((int)(PAGING_USER_BASE / PAGING_LARGE_SIZE))
+
+/**
+ * Reads the current page directory
+ * @return page directory loaded in CR3
+ */
+static inline pde_t *paging_get_dir(void) {
+    pde_t *dir;
+    asm volatile("movl %%cr3, %0" : "=r"(dir));
+    return dir;
+}
+
+/**
+ * Makes part of the kernel identity mapping readable from ring 3
+ * The 4MB pages covering the range are split into 4KB pages so that
+ * only the pages of the range are user accessible. The page tables are
+ * shared by every address space, so the pages are read only for user
+ * processes
+ * @param start - start of the range (page aligned)
+ * @param end - end of the range (page aligned)
+ */
+static void paging_map_user_range(unsigned int start, unsigned int end) {
+    pte_t *table;
+
+    // The kernel image is not linked by this tree; rounding the range
+    // would expose kernel code or data sharing the boundary pages
+    if((start | end) & (PAGE_SIZE - 1)) {
+        kernel_panic("User section 0x%x-0x%x is not page aligned!", start, end);
+    }
+
+    for(unsigned int addr = start; addr < end; addr += PAGE_SIZE) {
+        pde_t *pde = &paging_kernel_dir[addr >> 22];
+
+        if(*pde & PAGING_LARGE) {
+            table = frame_alloc(0);
+            if(!table) {
+                kernel_panic("Unable to allocate a kernel page table!");
+            }
+            for(int i = 0; i < PAGING_ENTRIES; i++) {
+                table[i] = ((*pde & PAGING_ADDR_MASK) + i * PAGE_SIZE) |
+                           PAGING_PRESENT | PAGING_WRITE | PAGING_GLOBAL;
+            }
+            *pde = (pde_t)table | PAGING_PRESENT | PAGING_WRITE | PAGING_USER;
+        }
+
+        table = (pte_t *)(*pde & PAGING_ADDR_MASK);
+        int i = (addr >> 12) & (PAGING_ENTRIES - 1);
+        table[i] = (table[i] & ~PAGING_WRITE) | PAGING_USER;
+    }
+}
+
+/**
+ * Builds the kernel identity mapping of physical memory with global
+ * 4MB pages, enables paging and installs the page fault task
+ * Must be called after frame_init() and gdt_init()
+ */
+void paging_init(void) {
+    unsigned int top;
+    unsigned int cr;
+
+    kernel_log_info("Initializing paging");
+
+    paging_kernel_dir = frame_alloc(0);
+    if(!paging_kernel_dir) {
+        kernel_panic("Unable to allocate the kernel page directory!");
+    }
+    memset(paging_kernel_dir, 0, PAGE_SIZE);
+
+    // Identity map all of physical memory
+    top = frame_memory_top();
+    for(int i = 0; i < PAGING_KERNEL_ENTRIES && (unsigned int)i * PAGING_LARGE_SIZE < top; i++) {
+        paging_kernel_dir[i] = (i * PAGING_LARGE_SIZE) | PAGING_PRESENT | PAGING_WRITE |
+                               PAGING_LARGE | PAGING_GLOBAL;
+    }
+
+    // User programs are linked into the kernel image
+    paging_map_user_range((unsigned int)__start_user_text, (unsigned int)__stop_user_text);
+    paging_map_user_range((unsigned int)__start_user_rodata, (unsigned int)__stop_user_rodata);
+
+    // Enable 4MB pages, then paging (with write protection so copy on
+    // write works for kernel accesses too), then global pages
+    asm volatile("movl %%cr4, %0" : "=r"(cr));
+    asm volatile("movl %0, %%cr4" : : "r"(cr | CR4_PSE));
+    asm volatile("movl %0, %%cr3" : : "r"(paging_kernel_dir) : "memory");
+    asm volatile("movl %%cr0, %0" : "=r"(cr));
+    asm volatile("movl %0, %%cr0" : : "r"(cr | CR0_PG | CR0_WP) : "memory");
+    asm volatile("movl %%cr4, %0" : "=r"(cr));
+    asm volatile("movl %0, %%cr4" : : "r"(cr | CR4_PGE));
+    tss.cr3 = (unsigned int)paging_kernel_dir;
+
+    // Page faults switch to a task with its own stack: a fault on an
+    // unmapped process stack could not push an interrupt frame there
+    memset(&paging_fault_tss, 0, sizeof(paging_fault_tss));
+    paging_fault_tss.cr3 = (unsigned int)paging_kernel_dir;
+    paging_fault_tss.eip = (unsigned int)isr_entry_page_fault;
+    paging_fault_tss.eflags = 0x2;
+    paging_fault_tss.esp = (unsigned int)&paging_fault_stack[PAGE_SIZE];
+    paging_fault_tss.cs = KCODE_SEG;
+    paging_fault_tss.ss = KDATA_SEG;
+    paging_fault_tss.ds = KDATA_SEG;
+    paging_fault_tss.es = KDATA_SEG;
+    paging_fault_tss.fs = KDATA_SEG;
+    paging_fault_tss.gs = KDATA_SEG;
+    paging_fault_tss.iomap = sizeof(tss_t);
+    gdt_set_tss(GDT_FAULT_TSS_SEG, &paging_fault_tss);
+    interrupts_task_gate_register(IRQ_PAGE_FAULT, GDT_FAULT_TSS_SEG);
+}
+
+/**
+ * Page fault handler
+ * Runs as the page fault task with the kernel address space loaded.
+ * The faulting state is in the main TSS; returning retries the
+ * faulting instruction
+ * @param error - page fault error code
+ */
+void paging_fault_handler(int error) {
+    unsigned int addr;
+    int kernel_context;
+
+    asm volatile("movl %%cr2, %0" : "=r"(addr));
+
+    // Faults in kernel context (on the kernel stack) are kernel bugs,
+    // unless the kernel is touching the user region of the process
+    kernel_context = tss.esp > (unsigned int)kstack && tss.esp <= (unsigned int)kstack + KSTACK_SIZE;
+
+    if(current && current->page_dir != paging_kernel_dir) {
+        // Give the process its own copy of a shared page
+        if((error & PAGING_FAULT_PRESENT) && (error & PAGING_FAULT_WRITE) &&
+           paging_cow_fault(current->page_dir, addr) == 0) {
+            return;
+        }
+        // Grow the process stack into the missing page
+        if(!(error & PAGING_FAULT_PRESENT) && kproc_stack_grow(current, addr) == 0) {
+            return;
+        }
+        // Map a new page in the (demand-zero) IPC area
+        if(!(error & PAGING_FAULT_PRESENT) && ipc_area_fault(current, addr) == 0) {
+            return;
+        }
+    }
+
+    if(!kernel_context && current && current->page_dir != paging_kernel_dir) {
+        // Anything else (including the guard page below the stack
+        // limit) kills the process: it resumes in ring 3 at the user
+        // exit stub on the top page of its stack, which is always mapped
+        kernel_log_error("Process %s (%d) page fault at 0x%x (eip 0x%x, error %d); killing it",
+                         current->name, current->pid, addr, tss.eip, error);
+        tss.eip = (unsigned int)user_exit;
+        tss.esp = PROC_USTACK_TOP - sizeof(unsigned int);
+        return;
+    }
+
+    kernel_panic("Page fault at 0x%x (eip 0x%x, error %d)!", addr, tss.eip, error);
+}
+
+/**
+ * Creates a new address space
+ * The kernel mappings are shared; the user region starts out empty
+ * @return page directory, NULL if out of memory
+ */
+pde_t *paging_dir_create(void) {
+    pde_t *dir = frame_alloc(0);
+
+    if(!dir) {
+        return NULL;
+    }
+    memcpy(dir, paging_kernel_dir, PAGING_KERNEL_ENTRIES * sizeof(pde_t));
+    memset(&dir[PAGING_KERNEL_ENTRIES], 0, (PAGING_ENTRIES - PAGING_KERNEL_ENTRIES) * sizeof(pde_t));
+    return dir;
+}
+
+/**
+ * Destroys an address space
+ * Frees the page tables of the user region and drops the references
+ * to every frame mapped with PAGING_OWNED
+ * @param dir - page directory (must not be the kernel page directory)
+ */
+void paging_dir_destroy(pde_t *dir) {
+    pte_t *table;
+
+    if(!dir || dir == paging_kernel_dir) {
+        return;
+    }
+
+    for(int i = PAGING_KERNEL_ENTRIES; i < PAGING_ENTRIES; i++) {
+        if(!(dir[i] & PAGING_PRESENT)) {
+            continue;
+        }
+        table = (pte_t *)(dir[i] & PAGING_ADDR_MASK);
+        for(int j = 0; j < PAGING_ENTRIES; j++) {
+            if((table[j] & PAGING_PRESENT) && (table[j] & PAGING_OWNED)) {
+                frame_put((void *)(table[j] & PAGING_ADDR_MASK));
+            }
+        }
+        frame_free(table);
+    }
+    frame_free(dir);
+}
+
+/**
+ * Duplicates an address space using copy on write
+ * Owned pages are shared read-only between both address spaces and
+ * copied on the first write; other pages are shared as they are
+ * @param dir - page directory to duplicate
+ * @return new page directory, NULL if out of memory
+ */
+pde_t *paging_dir_clone(pde_t *dir) {
+    pde_t *clone;
+    pte_t *table;
+    pte_t *clone_table;
+    pte_t pte;
+
+    clone = paging_dir_create();
+    if(!clone) {
+        return NULL;
+    }
+
+    for(int i = PAGING_KERNEL_ENTRIES; i < PAGING_ENTRIES; i++) {
+        if(!(dir[i] & PAGING_PRESENT)) {
+            continue;
+        }
+        clone_table = frame_alloc(0);
+        if(!clone_table) {
+            paging_dir_destroy(clone);
+            return NULL;
+        }
+        memset(clone_table, 0, PAGE_SIZE);
+        clone[i] = (pde_t)clone_table | (dir[i] & PAGING_FLAGS_MASK);
+
+        table = (pte_t *)(dir[i] & PAGING_ADDR_MASK);
+        for(int j = 0; j < PAGING_ENTRIES; j++) {
+            pte = table[j];
+            if(!(pte & PAGING_PRESENT)) {
+                continue;
+            }
+            if(pte & PAGING_OWNED) {
+                // Both address spaces now hold a reference to the frame
+                frame_get((void *)(pte & PAGING_ADDR_MASK));
+                if(pte & PAGING_WRITE) {
+                    pte = (pte & ~PAGING_WRITE) | PAGING_COW;
+                    table[j] = pte;
+                }
+            }
+            clone_table[j] = pte;
+        }
+    }
+
+    // Writable entries of the original were made read-only
+    if(dir == paging_get_dir()) {
+        paging_flush();
+    }
+    return clone;
+}
+
+/**
+ * Resolves a write fault on a copy on write page
+ * The page gets a private copy of the frame, or simply becomes
+ * writable again if no other address space shares the frame
+ * @param dir - page directory
+ * @param vaddr - faulting virtual address
+ * @return 0 on success, -1 if the page is not copy on write or there is no memory
+ */
+int paging_cow_fault(pde_t *dir, unsigned int vaddr) {
+    pte_t *pte = paging_get_pte(dir, vaddr);
+    void *frame;
+    void *copy;
+
+    if(!pte || !(*pte & PAGING_PRESENT) || !(*pte & PAGING_COW)) {
+        return -1;
+    }
+
+    frame = (void *)(*pte & PAGING_ADDR_MASK);
+    if(frame_refcount(frame) > 1) {
+        copy = frame_alloc(0);
+        if(!copy) {
+            return -1;
+        }
+        memcpy(copy, frame, PAGE_SIZE);
+        frame_put(frame);
+        *pte = (unsigned int)copy | (*pte & PAGING_FLAGS_MASK);
+    }
+    *pte = (*pte & ~PAGING_COW) | PAGING_WRITE;
+
+    if(dir == paging_get_dir()) {
+        paging_invalidate(vaddr & PAGING_ADDR_MASK);
+    }
+    return 0;
+}
+
+/**
+ * Looks up the page table entry for a virtual address
+ * @param dir - page directory
+ * @param vaddr - virtual address in the user region
+ * @return pointer to the page table entry, NULL if there is no page table
+ */
+pte_t *paging_get_pte(pde_t *dir, unsigned int vaddr) {
+    pde_t pde;
+
+    if(vaddr < PAGING_USER_BASE || vaddr >= PAGING_USER_END) {
+        return NULL;
+    }
+    pde = dir[vaddr >> 22];
+    if(!(pde & PAGING_PRESENT)) {
+        return NULL;
+    }
+    return &((pte_t *)(pde & PAGING_ADDR_MASK))[(vaddr >> 12) & (PAGING_ENTRIES - 1)];
+}
+
+/**
+ * Checks that a buffer is accessible from ring 3 in an address space
+ * Every page of the buffer must be present and mapped for user access
+ * @param dir - page directory
+ * @param vaddr - start of the buffer
+ * @param len - length of the buffer (bytes)
+ * @return 1 if the whole buffer is accessible, 0 otherwise
+ */
+int paging_user_access(pde_t *dir, unsigned int vaddr, unsigned int len) {
+    unsigned int end = vaddr + len;
+
+    if(end < vaddr) {
+        return 0;
+    }
+    for(unsigned int addr = vaddr & PAGING_ADDR_MASK; addr < end; addr += PAGE_SIZE) {
+        pde_t pde = dir[addr >> 22];
+        pte_t pte;
+
+        // Large pages are only used for the kernel mapping
+        if((pde & (PAGING_PRESENT | PAGING_USER | PAGING_LARGE)) != (PAGING_PRESENT | PAGING_USER)) {
+            return 0;
+        }
+        pte = ((pte_t *)(pde & PAGING_ADDR_MASK))[(addr >> 12) & (PAGING_ENTRIES - 1)];
+        if((pte & (PAGING_PRESENT | PAGING_USER)) != (PAGING_PRESENT | PAGING_USER)) {
+            return 0;
+        }
+        // The last page of the address space
+        if(addr + PAGE_SIZE < addr) {
+            break;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Maps a page in the user region of an address space
+ * @param dir - page directory
+ * @param vaddr - virtual address (page aligned)
+ * @param paddr - physical address (page aligned)
+ * @param flags - PAGING_* flags (PAGING_PRESENT is implied)
+ * @return 0 on success, -1 on error
+ */
+int paging_map(pde_t *dir, unsigned int vaddr, unsigned int paddr, int flags) {
+    pte_t *table;
+
+    if(vaddr < PAGING_USER_BASE || vaddr >= PAGING_USER_END || (vaddr & ~PAGING_ADDR_MASK)) {
+        return -1;
+    }
+
+    // Allocate the page table on first use; the directory entry grants
+    // everything and the page table entries restrict access
+    if(!(dir[vaddr >> 22] & PAGING_PRESENT)) {
+        table = frame_alloc(0);
+        if(!table) {
+            return -1;
+        }
+        memset(table, 0, PAGE_SIZE);
+        dir[vaddr >> 22] = (pde_t)table | PAGING_PRESENT | PAGING_WRITE | PAGING_USER;
+    } else {
+        table = (pte_t *)(dir[vaddr >> 22] & PAGING_ADDR_MASK);
+    }
+
+    table[(vaddr >> 12) & (PAGING_ENTRIES - 1)] = (paddr & PAGING_ADDR_MASK) | (flags & PAGING_FLAGS_MASK) | PAGING_PRESENT;
+    if(dir == paging_get_dir()) {
+        paging_invalidate(vaddr);
+    }
+    return 0;
+}
+
+/**
+ * Removes a page mapping from the user region of an address space
+ * The frame itself is not freed
+ * @param dir - page directory
+ * @param vaddr - virtual address (page aligned)
+ * @return page table entry that was removed, 0 if nothing was mapped
+ */
+pte_t paging_unmap(pde_t *dir, unsigned int vaddr) {
+    pte_t *pte = paging_get_pte(dir, vaddr);
+    pte_t old;
+
+    if(!pte || !(*pte & PAGING_PRESENT)) {
+        return 0;
+    }
+    old = *pte;
+    *pte = 0;
+    if(dir == paging_get_dir()) {
+        paging_invalidate(vaddr);
+    }
+    return old;
+}
@@ -15,10 +15,69 @@
 #include "kproc.h"
 #include "scheduler.h"
 #include "timer.h"
+#include "syscall.h"
 
-#include "queue.h"
+// Run queues, one per priority level
+proc_queue_t run_queue[SCHEDULER_PRIO_LEVELS];
 
-queue_t run_queue;
+// Bitmap of non-empty run queues (bit n set when run_queue[n] has entries)
+unsigned int run_bitmap;
+
+// Quantum (in ticks) for each priority level
+int run_quantum[SCHEDULER_PRIO_LEVELS];
+
+// Set when the current process yields the CPU
+int run_yield;
+
+/**
+ * Finds the highest priority level that has a runnable process
+ * @param bitmap - bitmap of non-empty run queues
+ * @return lowest set bit in the bitmap (bitmap must not be 0)
+ */
+static inline int scheduler_first_level(unsigned int bitmap) {
+    int level;
+    asm("bsfl %1, %0" : "=r"(level) : "rm"(bitmap));
+    return level;
+}
+
+/**
+ * Adds a process to the run queue for its priority level
+ * @param proc - pointer to the process entry
+ */
+static void run_queue_in(proc_t *proc) {
+    if(proc_queue_in(&run_queue[proc->priority], proc) == -1) {
+        return;
+    }
+    run_bitmap |= (1 << proc->priority);
+}
+
+/**
+ * Removes the next process from the run queue for the given priority level
+ * @param priority - priority level
+ * @return pointer to the process entry, NULL if the run queue is empty
+ */
+static proc_t *run_queue_out(int priority) {
+    proc_t *proc = proc_queue_out(&run_queue[priority]);
+    if(proc_queue_is_empty(&run_queue[priority])) {
+        run_bitmap &= ~(1 << priority);
+    }
+    return proc;
+}
+
+/**
+ * Removes a process from the middle of its run queue
+ * @param proc - pointer to the process entry
+ * @return 0 on success, -1 if the process is not in its run queue
+ */
+static int run_queue_remove(proc_t *proc) {
+    if(proc_queue_remove(&run_queue[proc->priority], proc) == -1) {
+        return -1;
+    }
+    if(proc_queue_is_empty(&run_queue[proc->priority])) {
+        run_bitmap &= ~(1 << proc->priority);
+    }
+    return 0;
+}
 
 /**
  * Update the current process' run time and CPU time
@@ -28,21 +87,68 @@ void scheduler_timer() {
     current->cpu_time++;
 }
 
+/**
+ * Periodic MLFQ boost
+ * Moves every process back to its base priority so that processes
+ * demoted for using their full quantum are not starved
+ */
+void scheduler_boost() {
+    proc_t *proc;
+
+    for(int i = 0; i < SCHEDULER_PRIO_LEVELS; i++) {
+        int size = run_queue[i].size;
+        for(int j = 0; j < size; j++) {
+            proc = run_queue_out(i);
+            proc->priority = proc->base_priority;
+            run_queue_in(proc);
+        }
+    }
+
+    if(current) {
+        current->priority = current->base_priority;
+    }
+}
+
 /**
  * Initialize the scheduler
  */
 void scheduler_init() {
-    /* Initialize the run queue */
+    /* Initialize the run queues */
     kernel_log_info("Initializing Scheduler");
-    if(queue_init(&run_queue) == -1){
-        kernel_log_error("Unable to initialize scheduler");
-        return;
+    for(int i = 0; i < SCHEDULER_PRIO_LEVELS; i++) {
+        proc_queue_init(&run_queue[i]);
+    }
+    run_bitmap = 0;
+    run_yield = 0;
+
+    /* Set up the quantum for each level */
+    for(int i = 0; i < SCHEDULER_PRIO_LEVELS; i++) {
+        if(SCHEDULER_MLFQ && (SCHEDULER_QUANTUM_BASE << i) < SCHEDULER_TIMESLICE) {
+            run_quantum[i] = SCHEDULER_QUANTUM_BASE << i;
+        } else {
+            run_quantum[i] = SCHEDULER_TIMESLICE;
+        }
     }
 
-    /* Register the timer callback */
-    if(timer_callback_register(&scheduler_timer, 1, -1) == -1) {
+    /* Register the timer callback; CPU time is not accounted while idle */
+    /* and must be charged to the process the tick interrupted */
+    int id = timer_callback_register(&scheduler_timer, 1, -1, 0);
+    if(id == -1) {
         kernel_log_error("Unable to register scheduler timer!");
+    } else {
+        timer_callback_set_flags(id, TIMER_FLAG_DEFERRABLE | TIMER_FLAG_IRQ);
     }
+
+#if SCHEDULER_MLFQ
+    /* Register the priority boost; nothing needs a boost while idle */
+    id = timer_callback_register(&scheduler_boost, SCHEDULER_BOOST_INTERVAL, -1,
+                                 SCHEDULER_BOOST_INTERVAL / 10);
+    if(id == -1) {
+        kernel_log_error("Unable to register scheduler boost!");
+    } else {
+        timer_callback_set_flags(id, TIMER_FLAG_DEFERRABLE | TIMER_FLAG_IRQ);
+    }
+#endif
 }
 
 /**
@@ -50,27 +156,48 @@ void scheduler_init() {
  */
 void scheduler_run() {
 
-    if(current){
-        //if we haven't expired our timeslice, return
-        if(current->cpu_time < SCHEDULER_TIMESLICE) {
+    if(current && (current->state == BLOCKED || current->state == ZOMBIE)){
+        //the process gave up the CPU to wait for an event (or exited); it
+        //is not requeued until scheduler_wake() is called for it
+    } else if(current){
+        //the idle task ranks below every priority level
+        int priority = (current->pid == 0) ? SCHEDULER_PRIO_LEVELS : current->priority;
+
+        //if we haven't expired our quantum or yielded and nothing of
+        //higher priority is waiting, return
+        int expired = (current->pid != 0 && current->cpu_time >= run_quantum[current->priority]);
+        if(!expired && !run_yield && !(run_bitmap & ((1 << priority) - 1))) {
             return;
         }
 
-        //if the current pid isn't the idle task, requeue
+        if(expired) {
+            //a user process that used its whole quantum drops a level
+            if(SCHEDULER_MLFQ && current->type == PROC_TYPE_USER &&
+               current->priority < SCHEDULER_PRIO_LEVELS - 1) {
+                current->priority++;
+            }
+            //start a fresh quantum
+            current->cpu_time = 0;
+        }
+
+        //if the current pid isn't the idle task, requeue. A preempted
+        //process keeps the unused part of its quantum
         if(current->pid != 0){
-            queue_in(&run_queue, current->pid);
+            run_queue_in(current);
+        } else {
+            current->cpu_time = 0;
         }
-        //set cpu time to 0 for good measure and set task to idle
-        current->cpu_time = 0;
         current->state = IDLE;
     }
 
-    //queue out the next process, and set it as our current task
-    int pid;
-    if(queue_out(&run_queue, &pid) == -1){
-        current = pid_to_proc(0);
+    run_yield = 0;
+
+    //queue out the next process from the highest non-empty priority level,
+    //and set it as our current task
+    if(run_bitmap) {
+        current = run_queue_out(scheduler_first_level(run_bitmap));
     } else {
-        current = pid_to_proc(pid);
+        current = pid_to_proc(0);
     }
 
     //check what we got back is valid
@@ -82,6 +209,33 @@ void scheduler_run() {
     current->state = RUNNING;
 }
 
+/**
+ * Gives up the rest of the current process' quantum
+ * The process goes to the back of its run queue the next time the
+ * scheduler runs (without an MLFQ demotion)
+ */
+void scheduler_yield(void) {
+    run_yield = 1;
+    if(current) {
+        current->cpu_time = 0;
+    }
+}
+
+/**
+ * Switches away from the current kernel process right away
+ * The caller sets the state of the process first (BLOCKED or ZOMBIE);
+ * a yield system call enters the kernel, and scheduler_run() does not
+ * keep a process in either state. Returns once the process runs again
+ * Must be called with interrupts disabled; returns with interrupts
+ * disabled
+ */
+void scheduler_switch(void) {
+    int num = SYSCALL_YIELD;
+
+    // System calls return their result in eax
+    asm volatile("int %1" : "+a"(num) : "i"(IRQ_SYSCALL) : "memory");
+}
+
 /**
  * Adds a process to the scheduler
  * @param proc - pointer to the process entry
@@ -95,7 +249,7 @@ void scheduler_add(proc_t *proc) {
     //set process state to idle and add to queue if it isn't the kernel idle task
     proc->state = IDLE;
     if(proc->pid != 0) {
-        queue_in(&run_queue, proc->pid);
+        run_queue_in(proc);
     }
 }
 
@@ -125,27 +279,60 @@ void scheduler_remove(proc_t *proc) {
     }
 
     /*
-     * Otherwise, cycle through all of the processes (dequeueing and requeueing)
-     * until we find the process we are looking for or we have cycled through
-     * them all. Once the correct process is found, we simply keep it dequeued.
+     * Otherwise, unlink the process from its run queue. The order of
+     * the remaining processes is kept.
      */
-    int pid;
-    for(int i = 0; i < run_queue.size; i++) {
-        if(queue_out(&run_queue, &pid) == -1) {
-            kernel_log_error("Attempted removal from empty run queue!");
-            return;
-        }
+    if(run_queue_remove(proc) == -1) {
+        kernel_log_error("Attempted removal of process not in run queue!");
+        return;
+    }
+    proc->state = NONE;
+}
 
-        if(pid == proc->pid) {
-            proc_t* proc = pid_to_proc(pid);
-            proc->state = NONE;
-            return;
-        }
+/**
+ * Makes a blocked process runnable again
+ * If the process blocked itself but has not been switched out yet,
+ * it simply continues running
+ * @param proc - pointer to the process entry
+ */
+void scheduler_wake(proc_t *proc) {
+    if(!proc || proc->state != BLOCKED) {
+        return;
+    }
 
-        if(queue_in(&run_queue, pid) == -1) {
-            kernel_log_error("Attempted requeue into full run queue!");
-            return;
-        }
+    if(proc == current) {
+        proc->state = RUNNING;
+    } else {
+        scheduler_add(proc);
     }
 }
 
+/**
+ * Changes the priority of a process
+ * If the process is waiting in the run queue it is moved to the
+ * run queue for the new priority level
+ * @param proc - pointer to the process entry
+ * @param priority - new priority (0 to SCHEDULER_PRIO_LEVELS-1)
+ * @return 0 on success, -1 on error
+ */
+int scheduler_set_priority(proc_t *proc, int priority) {
+    if(!proc || priority < 0 || priority >= SCHEDULER_PRIO_LEVELS) {
+        kernel_log_error("Invalid process priority change!");
+        return -1;
+    }
+
+    proc->base_priority = priority;
+    if(proc->priority == priority) {
+        return 0;
+    }
+
+    //a process waiting in a run queue must be moved to its new level
+    if(proc != current && proc->state == IDLE && proc->pid != 0) {
+        scheduler_remove(proc);
+        proc->priority = priority;
+        scheduler_add(proc);
+    } else {
+        proc->priority = priority;
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Slab object allocator
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "slab.h"
+#include "frame.h"
+
+/**
+ * Initializes an object cache
+ * No memory is allocated until the first object is requested
+ * @param cache - pointer to the cache
+ * @param name - cache name
+ * @param obj_size - size of each object
+ * @return 0 on success, -1 on error
+ */
+int slab_cache_init(slab_cache_t *cache, char *name, int obj_size) {
+    if(!cache || obj_size <= 0) {
+        kernel_log_error("Unable to initialize slab cache!");
+        return -1;
+    }
+
+    memset(cache, 0, sizeof(slab_cache_t));
+    cache->name = name;
+
+    // Objects must be able to hold the free list link
+    if(obj_size < (int)sizeof(void *)) {
+        obj_size = sizeof(void *);
+    }
+    cache->obj_size = (obj_size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+
+    // Small objects share a page; large objects get a block of frames
+    cache->slab_order = frame_order(cache->obj_size);
+    if(cache->slab_order == -1) {
+        kernel_log_error("Slab cache %s: objects are too large!", name);
+        return -1;
+    }
+    cache->slab_size = PAGE_SIZE << cache->slab_order;
+    return 0;
+}
+
+/**
+ * Allocates an object from a cache, growing the cache if needed
+ * The object contents are not initialized
+ * @param cache - pointer to the cache
+ * @return pointer to the object, NULL if out of memory
+ */
+void *slab_alloc(slab_cache_t *cache) {
+    unsigned char *slab;
+    void *obj;
+
+    if(!cache->free) {
+        // Carve a new slab into objects and add them to the free list
+        slab = frame_alloc(cache->slab_order);
+        if(!slab) {
+            kernel_log_warn("Slab cache %s: out of memory!", cache->name);
+            return NULL;
+        }
+        for(int offset = 0; offset + cache->obj_size <= cache->slab_size; offset += cache->obj_size) {
+            *(void **)(slab + offset) = cache->free;
+            cache->free = slab + offset;
+            cache->total++;
+        }
+        cache->slabs++;
+    }
+
+    obj = cache->free;
+    cache->free = *(void **)obj;
+    cache->inuse++;
+    return obj;
+}
+
+/**
+ * Returns an object to its cache
+ * @param cache - pointer to the cache the object was allocated from
+ * @param obj - pointer to the object
+ */
+void slab_free(slab_cache_t *cache, void *obj) {
+    if(!cache || !obj) {
+        return;
+    }
+    *(void **)obj = cache->free;
+    cache->free = obj;
+    cache->inuse--;
+}
@@ -0,0 +1,169 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Semaphores and mutexes
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "interrupts.h"
+#include "kproc.h"
+#include "scheduler.h"
+#include "sync.h"
+
+/**
+ * Blocks the current process until it is taken off a wait queue
+ * Must be called with interrupts disabled; returns with interrupts
+ * enabled
+ * @param queue - wait queue
+ */
+static void sync_block(proc_queue_t *queue) {
+    proc_queue_in(queue, current);
+
+    // The waker removes the process from the queue before waking it, so
+    // any other wakeup is ignored. Interrupts stay disabled until the
+    // process has been switched out, so the wakeup cannot be missed
+    while(current->queue == queue) {
+        current->state = BLOCKED;
+        scheduler_switch();
+    }
+    interrupts_enable();
+}
+
+/**
+ * Wakes the first process on a wait queue
+ * Must be called with interrupts disabled
+ * @param queue - wait queue
+ * @return process that was woken, NULL if the queue is empty
+ */
+static proc_t *sync_wake(proc_queue_t *queue) {
+    proc_t *proc = proc_queue_out(queue);
+
+    if(proc) {
+        scheduler_wake(proc);
+    }
+    return proc;
+}
+
+/**
+ * Initializes a semaphore
+ * @param sem - semaphore
+ * @param count - initial number of units
+ */
+void semaphore_init(semaphore_t *sem, int count) {
+    sem->count = count;
+    proc_queue_init(&sem->waiters);
+}
+
+/**
+ * Takes a unit, blocking until one is available
+ * @param sem - semaphore
+ */
+void semaphore_wait(semaphore_t *sem) {
+    interrupts_disable();
+    if(sem->count > 0) {
+        sem->count--;
+        interrupts_enable();
+        return;
+    }
+    // semaphore_post() hands the unit over directly
+    sync_block(&sem->waiters);
+}
+
+/**
+ * Takes a unit if one is available
+ * @param sem - semaphore
+ * @return 0 on success, -1 if no unit is available
+ */
+int semaphore_trywait(semaphore_t *sem) {
+    int flags = interrupts_save();
+    int ret = -1;
+
+    if(sem->count > 0) {
+        sem->count--;
+        ret = 0;
+    }
+    interrupts_restore(flags);
+    return ret;
+}
+
+/**
+ * Returns a unit, handing it to the first waiting process (if any)
+ * @param sem - semaphore
+ */
+void semaphore_post(semaphore_t *sem) {
+    int flags = interrupts_save();
+
+    if(!sync_wake(&sem->waiters)) {
+        sem->count++;
+    }
+    interrupts_restore(flags);
+}
+
+/**
+ * Initializes a mutex (unlocked)
+ * @param mutex - mutex
+ */
+void mutex_init(mutex_t *mutex) {
+    mutex->owner = NULL;
+    proc_queue_init(&mutex->waiters);
+}
+
+/**
+ * Locks a mutex, blocking until it is free
+ * @param mutex - mutex (must not be held by the calling process)
+ * @return 0 on success, -1 if the calling process already holds it
+ */
+int mutex_lock(mutex_t *mutex) {
+    interrupts_disable();
+    if(mutex->owner == current) {
+        interrupts_enable();
+        kernel_log_error("Process %s (%d) already holds the mutex!", current->name, current->pid);
+        return -1;
+    }
+    if(!mutex->owner) {
+        mutex->owner = current;
+        interrupts_enable();
+        return 0;
+    }
+    // mutex_unlock() makes this process the owner before waking it
+    sync_block(&mutex->waiters);
+    return 0;
+}
+
+/**
+ * Locks a mutex if it is free
+ * @param mutex - mutex
+ * @return 0 on success, -1 if the mutex is held
+ */
+int mutex_trylock(mutex_t *mutex) {
+    int flags = interrupts_save();
+    int ret = -1;
+
+    if(!mutex->owner) {
+        mutex->owner = current;
+        ret = 0;
+    }
+    interrupts_restore(flags);
+    return ret;
+}
+
+/**
+ * Unlocks a mutex, handing it to the first waiting process (if any)
+ * @param mutex - mutex (must be held by the calling process)
+ * @return 0 on success, -1 if the calling process does not hold it
+ */
+int mutex_unlock(mutex_t *mutex) {
+    int flags = interrupts_save();
+
+    if(mutex->owner != current) {
+        interrupts_restore(flags);
+        kernel_log_error("Process %s (%d) does not hold the mutex!", current->name, current->pid);
+        return -1;
+    }
+    mutex->owner = sync_wake(&mutex->waiters);
+    interrupts_restore(flags);
+    return 0;
+}
@@ -0,0 +1,473 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * System calls
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "interrupts.h"
+#include "gdt.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "timer.h"
+#include "vga.h"
+#include "frame.h"
+#include "kmalloc.h"
+#include "futex.h"
+#include "ipc.h"
+
+#if SYSCALL_RING_ADDR != PAGING_USER_BASE
+#error "SYSCALL_RING_ADDR must be the first page of the user region"
+#endif
+
+// Timer requests (timer system call) take slots in the global timer
+// table. They may use at most a quarter of it, so sleep, futex timeouts
+// and kernel timers keep the rest, and one process at most a quarter
+// of that
+#define SYSCALL_TIMERS_MAX      (TIMERS_MAX / 4)
+#define SYSCALL_PROC_TIMERS_MAX (SYSCALL_TIMERS_MAX / 4)
+
+// Pending timer request (timer system call)
+typedef struct syscall_timer_t {
+    int pid;                    // Process to post the completion to
+    unsigned int user_data;     // Value for the completion
+} syscall_timer_t;
+
+// Number of pending timer requests of all processes
+int syscall_timers_pending;
+
+// System call entries (context.S)
+extern void isr_entry_syscall(void);
+extern void sysenter_entry(void);
+
+// Kernel stack (context.S)
+extern char kstack[];
+
+/**
+ * write(fd, buf, len)
+ * Writes characters to the console
+ * @param fd - file descriptor (SYSCALL_FD_STDOUT)
+ * @param buf - characters to write
+ * @param len - number of characters
+ * @return number of characters written, -1 on error
+ */
+static int syscall_write(unsigned int fd, unsigned int buf, unsigned int len) {
+    char *str = (char *)buf;
+
+    if(fd != SYSCALL_FD_STDOUT || !str || (int)len < 0) {
+        return -1;
+    }
+    // User processes may only pass buffers they can access themselves
+    if(current->type == PROC_TYPE_USER && !paging_user_access(current->page_dir, buf, len)) {
+        return -1;
+    }
+    for(unsigned int i = 0; i < len; i++) {
+        vga_putc(str[i]);
+    }
+    return len;
+}
+
+/**
+ * yield()
+ * Gives up the rest of the current quantum
+ * @return 0
+ */
+static int syscall_yield(unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    (void)arg1; (void)arg2; (void)arg3;
+    scheduler_yield();
+    return 0;
+}
+
+/**
+ * Wakes a sleeping process (timer callback)
+ * @param arg - process id
+ */
+static void syscall_sleep_wake(void *arg) {
+    // The process may have been destroyed while it slept
+    scheduler_wake(pid_to_proc((int)arg));
+}
+
+/**
+ * sleep(ms)
+ * Blocks the current process for a number of milliseconds
+ * @param ms - milliseconds (rounded up to timer ticks)
+ * @return 0 on success, -1 on error
+ */
+static int syscall_sleep(unsigned int ms, unsigned int arg2, unsigned int arg3) {
+    int ticks;
+    (void)arg2; (void)arg3;
+
+    if((int)ms < 0) {
+        return -1;
+    }
+    ticks = timer_ms_to_ticks(ms);
+    if(ticks == 0) {
+        return syscall_yield(0, 0, 0);
+    }
+
+    // Long sleeps may be stretched a little to share a wakeup with
+    // other timers
+    if(timer_callback_register_arg(syscall_sleep_wake, (void *)current->pid, ticks, 0, ticks >> 4) == -1) {
+        return -1;
+    }
+    current->state = BLOCKED;
+    return 0;
+}
+
+/**
+ * getpid()
+ * @return process id of the current process
+ */
+static int syscall_getpid(unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    (void)arg1; (void)arg2; (void)arg3;
+    return current->pid;
+}
+
+/**
+ * exit()
+ * Ends the current process
+ * @return 0 (never seen by the process)
+ */
+static int syscall_exit(unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    (void)arg1; (void)arg2; (void)arg3;
+    kproc_exit_current();
+    return 0;
+}
+
+/**
+ * ring_setup()
+ * Maps the shared ring page into the current process
+ * @return address of the ring page, -1 on error
+ */
+static int syscall_ring_setup(unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    syscall_ring_t *ring;
+    (void)arg1; (void)arg2; (void)arg3;
+
+    if(current->type != PROC_TYPE_USER) {
+        return -1;
+    }
+    if(current->ring) {
+        return SYSCALL_RING_ADDR;
+    }
+    // The kernel reaches the ring through the identity mapping of its
+    // frame, so it is never copied on write behind the kernel's back
+    // (see kproc_clone)
+    ring = frame_alloc(0);
+    if(!ring) {
+        return -1;
+    }
+    memset(ring, 0, PAGE_SIZE);
+    if(paging_map(current->page_dir, SYSCALL_RING_ADDR, (unsigned int)ring,
+                  PAGING_WRITE | PAGING_USER | PAGING_OWNED) == -1) {
+        frame_free(ring);
+        return -1;
+    }
+    current->ring = ring;
+    return SYSCALL_RING_ADDR;
+}
+
+/**
+ * ring_enter()
+ * Doorbell: handles the queued requests right away
+ * @return number of requests handled
+ */
+static int syscall_ring_enter(unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    (void)arg1; (void)arg2; (void)arg3;
+    return syscall_ring_drain();
+}
+
+/**
+ * Posts a completion to the ring of a process
+ * @param ring - ring of the process
+ * @param user_data - value for the completion
+ * @param result - result for the completion
+ * @return 0 on success, -1 if the completion queue is full
+ */
+static int syscall_ring_post(syscall_ring_t *ring, unsigned int user_data, int result) {
+    unsigned int tail = ring->cq_tail;
+
+    if(tail - ring->cq_head >= SYSCALL_RING_ENTRIES) {
+        return -1;
+    }
+    ring->cq[tail & (SYSCALL_RING_ENTRIES - 1)].user_data = user_data;
+    ring->cq[tail & (SYSCALL_RING_ENTRIES - 1)].result = result;
+    ring->cq_tail = tail + 1;
+    return 0;
+}
+
+/**
+ * Posts the completion of a timer request (timer callback)
+ * @param arg - timer request
+ */
+static void syscall_timer_expire(void *arg) {
+    syscall_timer_t *timer = arg;
+    // The process may have ended while the timer was pending
+    proc_t *proc = pid_to_proc(timer->pid);
+
+    syscall_timers_pending--;
+    if(proc) {
+        proc->ring_timers--;
+        if(proc->ring && syscall_ring_post(proc->ring, timer->user_data, 0) == -1) {
+            proc->ring->cq_overflow++;
+        }
+    }
+    kfree(timer);
+}
+
+/**
+ * timer(ms, user_data)
+ * Arms a one-shot timer that posts a completion to the ring of the
+ * current process when it expires
+ * Timers come from the global timer table, so the number pending is
+ * limited for all processes together and for each process
+ * @param ms - milliseconds (rounded up to timer ticks)
+ * @param user_data - value for the completion
+ * @return 0 on success, -1 on error
+ */
+static int syscall_timer(unsigned int ms, unsigned int user_data, unsigned int arg3) {
+    syscall_timer_t *timer;
+    int ticks;
+    (void)arg3;
+
+    if((int)ms < 0 || !current->ring || current->ring_timers >= SYSCALL_PROC_TIMERS_MAX ||
+       syscall_timers_pending >= SYSCALL_TIMERS_MAX) {
+        return -1;
+    }
+    ticks = timer_ms_to_ticks(ms);
+    if(ticks == 0) {
+        ticks = 1;
+    }
+    timer = kmalloc(sizeof(syscall_timer_t));
+    if(!timer) {
+        return -1;
+    }
+    timer->pid = current->pid;
+    timer->user_data = user_data;
+    if(timer_callback_register_arg(syscall_timer_expire, timer, ticks, 0, ticks >> 4) == -1) {
+        kfree(timer);
+        return -1;
+    }
+    current->ring_timers++;
+    syscall_timers_pending++;
+    return 0;
+}
+
+/**
+ * futex_wait(addr, expected, ms)
+ * Blocks the current process while a word holds an expected value
+ * @param addr - address of the word
+ * @param expected - value the word must hold for the process to block
+ * @param ms - timeout in milliseconds, 0 to wait forever
+ * @return 0 when woken, -1 on timeout, if the word changed or the
+ *         address is invalid
+ */
+static int syscall_futex_wait(unsigned int addr, unsigned int expected, unsigned int ms) {
+    return futex_wait(addr, expected, ms);
+}
+
+/**
+ * futex_wake(addr, count)
+ * Wakes processes waiting on a word
+ * @param addr - address of the word
+ * @param count - maximum number of processes to wake
+ * @return number of processes woken, -1 if the address is invalid
+ */
+static int syscall_futex_wake(unsigned int addr, unsigned int count, unsigned int arg3) {
+    (void)arg3;
+    return futex_wake(addr, count);
+}
+
+/**
+ * send(dest)
+ * The message is passed in registers, so the IPC system calls are only
+ * available through int (see ipc.h)
+ * @param dest - process id of the receiver (edi)
+ * @return 0 on success, -1 on error
+ */
+static int syscall_ipc_send(unsigned int arg1, unsigned int arg2, unsigned int dest) {
+    (void)arg1; (void)arg2;
+    return ipc_send(dest);
+}
+
+/**
+ * receive()
+ * @return process id of the sender, -1 on error
+ */
+static int syscall_ipc_recv(unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    (void)arg1; (void)arg2; (void)arg3;
+    return ipc_receive();
+}
+
+/**
+ * call(dest)
+ * @param dest - process id of the receiver (edi)
+ * @return process id of the replier, -1 on error
+ */
+static int syscall_ipc_call(unsigned int arg1, unsigned int arg2, unsigned int dest) {
+    (void)arg1; (void)arg2;
+    return ipc_call(dest);
+}
+
+/**
+ * reply(dest)
+ * @param dest - process id of the caller (edi)
+ * @return 0 on success, -1 on error
+ */
+static int syscall_ipc_reply(unsigned int arg1, unsigned int arg2, unsigned int dest) {
+    (void)arg1; (void)arg2;
+    return ipc_reply(dest);
+}
+
+/**
+ * clone()
+ * Clones the current process with a copy on write duplicate of its
+ * address space. Both processes return from the system call
+ * @return process id of the clone in the original, 0 in the clone,
+ *         -1 on error
+ */
+static int syscall_clone(unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    int pid;
+    (void)arg1; (void)arg2; (void)arg3;
+
+    if(current->type != PROC_TYPE_USER) {
+        return -1;
+    }
+    pid = kproc_clone(current);
+    if(pid != -1) {
+        // The clone resumes from the saved state of this system call
+        pid_to_proc(pid)->trapframe->eax = 0;
+    }
+    return pid;
+}
+
+// System call table, indexed by system call number
+syscall_handler_t syscall_table[SYSCALL_MAX] = {
+    [SYSCALL_WRITE]      = syscall_write,
+    [SYSCALL_YIELD]      = syscall_yield,
+    [SYSCALL_SLEEP]      = syscall_sleep,
+    [SYSCALL_GETPID]     = syscall_getpid,
+    [SYSCALL_EXIT]       = syscall_exit,
+    [SYSCALL_RING_SETUP] = syscall_ring_setup,
+    [SYSCALL_RING_ENTER] = syscall_ring_enter,
+    [SYSCALL_TIMER]      = syscall_timer,
+    [SYSCALL_FUTEX_WAIT] = syscall_futex_wait,
+    [SYSCALL_FUTEX_WAKE] = syscall_futex_wake,
+    [SYSCALL_IPC_SEND]   = syscall_ipc_send,
+    [SYSCALL_IPC_RECV]   = syscall_ipc_recv,
+    [SYSCALL_IPC_CALL]   = syscall_ipc_call,
+    [SYSCALL_IPC_REPLY]  = syscall_ipc_reply,
+    [SYSCALL_CLONE]      = syscall_clone,
+};
+
+// Ways each system call may be made besides int (system calls that
+// never block or switch processes)
+int syscall_flags[SYSCALL_MAX] = {
+    [SYSCALL_WRITE]      = SYSCALL_FLAG_FAST | SYSCALL_FLAG_RING,
+    [SYSCALL_GETPID]     = SYSCALL_FLAG_FAST | SYSCALL_FLAG_RING,
+    [SYSCALL_RING_ENTER] = SYSCALL_FLAG_FAST,
+    [SYSCALL_TIMER]      = SYSCALL_FLAG_FAST | SYSCALL_FLAG_RING,
+    [SYSCALL_FUTEX_WAKE] = SYSCALL_FLAG_FAST | SYSCALL_FLAG_RING,
+};
+
+/**
+ * Writes a model specific register
+ * @param msr - register number
+ * @param value - value (upper 32 bits are cleared)
+ */
+static inline void syscall_wrmsr(unsigned int msr, unsigned int value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+/**
+ * Installs the system call gate and the sysenter entry point
+ */
+void syscall_init(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    kernel_log_info("Initializing system calls");
+    syscall_timers_pending = 0;
+    interrupts_user_gate_register(IRQ_SYSCALL, isr_entry_syscall);
+
+    // sysenter (CPUID SEP); the kernel stack is free whenever a process
+    // runs in ring 3
+    asm("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if(!(edx & (1 << 11))) {
+        kernel_log_warn("sysenter is not supported!");
+        return;
+    }
+    syscall_wrmsr(MSR_SYSENTER_CS, KCODE_SEG);
+    syscall_wrmsr(MSR_SYSENTER_ESP, (unsigned int)kstack + KSTACK_SIZE);
+    syscall_wrmsr(MSR_SYSENTER_EIP, (unsigned int)sysenter_entry);
+}
+
+/**
+ * Dispatches a system call for the current process
+ * @param trapframe - trapframe saved on entry
+ */
+void syscall_dispatch(trapframe_t *trapframe) {
+    unsigned int num = trapframe->eax;
+
+    if(num >= SYSCALL_MAX || !syscall_table[num]) {
+        trapframe->eax = -1;
+        return;
+    }
+    trapframe->eax = syscall_table[num](trapframe->ebx, trapframe->esi, trapframe->edi);
+}
+
+/**
+ * Dispatches a system call made with sysenter
+ * Only system calls that never block or switch processes are
+ * available through sysenter; the others must use int
+ * @param num - system call number
+ * @param arg1 - first argument
+ * @param arg2 - second argument
+ * @param arg3 - third argument
+ * @return system call result, -1 if the call is not available
+ */
+int syscall_fast_dispatch(unsigned int num, unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    if(num >= SYSCALL_MAX || !(syscall_flags[num] & SYSCALL_FLAG_FAST)) {
+        return -1;
+    }
+    return syscall_table[num](arg1, arg2, arg3);
+}
+
+/**
+ * Handles the requests queued in the submission ring of the current
+ * process, as long as there is room for their completions
+ * Only system calls that never block or switch processes are
+ * available through the ring; the others complete with -1
+ * Must be called with interrupts disabled and the address space of the
+ * current process loaded
+ * @return number of requests handled
+ */
+int syscall_ring_drain(void) {
+    syscall_ring_t *ring = current->ring;
+    unsigned int head;
+    int count = 0;
+
+    if(!ring) {
+        return 0;
+    }
+    // The indices are in memory the process can write, so never handle
+    // more than one ring's worth of requests per call
+    head = ring->sq_head;
+    while(head != ring->sq_tail && count < SYSCALL_RING_ENTRIES) {
+        syscall_sqe_t sqe = ring->sq[head & (SYSCALL_RING_ENTRIES - 1)];
+        int result = -1;
+
+        if(ring->cq_tail - ring->cq_head >= SYSCALL_RING_ENTRIES) {
+            break;
+        }
+        if(sqe.num < SYSCALL_MAX && (syscall_flags[sqe.num] & SYSCALL_FLAG_RING)) {
+            result = syscall_table[sqe.num](sqe.arg1, sqe.arg2, sqe.arg3);
+        }
+        syscall_ring_post(ring, sqe.user_data, result);
+        head++;
+        count++;
+    }
+    ring->sq_head = head;
+    return count;
+}
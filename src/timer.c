@@ -9,11 +9,39 @@
 #include <spede/string.h>
 
 #include "interrupts.h"
-#include "queue.h"
 
 #include "timer.h"
 #include "vga.h"
 #include "kernel.h"
+#include "workqueue.h"
+#include "clock.h"
+
+// Programmable interval timer (PIT) definitions
+#define PIT_FREQ        1193182                     // PIT input clock (Hz)
+#define PIT_DIVISOR     (PIT_FREQ / TIMER_HZ)       // Count for one tick
+#define PIT_CH0_DATA    0x40                        // Channel 0 data port
+#define PIT_CMD         0x43                        // Mode/command port
+#define PIT_CMD_LATCH   0x00                        // Latch channel 0 count
+#define PIT_CMD_ONESHOT 0x30                        // Channel 0, lo/hi, mode 0
+#define PIT_CMD_PERIODIC 0x34                       // Channel 0, lo/hi, mode 2
+
+// Longest tickless period the 16-bit PIT counter can be programmed for
+#define TIMER_TICKLESS_MAX (0xffff / PIT_DIVISOR)
+
+// Timing wheel geometry: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SIZE
+// slots each. Level n holds timers due within 2^(6*(n+1)) ticks.
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SIZE   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX    ((1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+// Index into a wheel level for the given tick
+#define TIMER_WHEEL_INDEX(ticks, level) \
+    (((ticks) >> (TIMER_WHEEL_BITS * (level))) & TIMER_WHEEL_MASK)
+
+// Internal timer flag: the callback takes an argument
+#define TIMER_FLAG_ARG 0x80
 
 /**
  * Forward Declarations
@@ -24,11 +52,21 @@ void timer_irq_handler(void);
  * Data structures
  */
 // Timer data structure
-typedef struct timer_t {
+typedef struct timer_t timer_t;
+struct timer_t {
     void (*callback)(); // Function to call when the interval occurs
+    void *arg;          // Argument for the function (with TIMER_FLAG_ARG)
     int interval;       // Interval in which the timer will be called
     int repeat;         // Indicate how many intervals to repeat (-1 should repeat forever)
-} timer_t;
+    int flags;          // TIMER_FLAG_* values
+    int slack;          // Number of ticks the callback may be delayed by
+    int due;            // Tick at which the interval elapses
+    int expires;        // Tick at which the timer fires (due plus slack)
+
+    timer_t **bucket;   // Wheel slot (or list) the timer is linked into
+    timer_t *next;      // Next timer in the slot (or the free list)
+    timer_t *prev;      // Previous timer in the slot
+};
 
 
 /**
@@ -40,8 +78,150 @@ int timer_ticks;
 // Timers table; each item in the array is a timer_t struct
 timer_t timers[TIMERS_MAX];
 
-// Timer allocator; used to allocate indexes into the timers table
-queue_t timer_allocator;
+// Free timers, linked through timer_t.next
+timer_t *timer_free;
+
+// Timing wheel; each slot is a list of timers
+timer_t *timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+
+// Next tick to be processed by the timing wheel
+int wheel_ticks;
+
+// Timers that are due and waiting for their callback to run
+timer_t *timer_expired;
+
+// Number of ticks the PIT was programmed for in one-shot mode (0 if periodic)
+int tickless_ticks;
+
+// PIT counts elapsed during tickless periods not yet accounted as a tick
+int tickless_remainder;
+
+/**
+ * Links a timer into a list
+ * @param bucket - list head
+ * @param timer - timer to link
+ */
+static void timer_link(timer_t **bucket, timer_t *timer) {
+    timer->bucket = bucket;
+    timer->prev = NULL;
+    timer->next = *bucket;
+    if(*bucket) {
+        (*bucket)->prev = timer;
+    }
+    *bucket = timer;
+}
+
+/**
+ * Unlinks a timer from the list it is in (if any)
+ * @param timer - timer to unlink
+ */
+static void timer_unlink(timer_t *timer) {
+    if(!timer->bucket) {
+        return;
+    }
+    if(timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->bucket = timer->next;
+    }
+    if(timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->bucket = NULL;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+/**
+ * Picks the tick a timer fires at within its slack window
+ *
+ * The end of the window is rounded down to the coarsest power-of-two
+ * boundary that is still inside the window, so timers whose windows
+ * overlap tend to land on the same tick and fire in one batch.
+ * @param due - tick at which the interval elapses
+ * @param slack - number of ticks the timer may be delayed by
+ * @return tick at which the timer should fire
+ */
+static int timer_apply_slack(int due, int slack) {
+    int limit = due + slack;
+    int bit;
+
+    if(slack <= 0) {
+        return due;
+    }
+
+    // Highest bit that differs between the start and end of the window
+    asm("bsrl %1, %0" : "=r"(bit) : "rm"(due ^ limit));
+    return limit & ~((1 << bit) - 1);
+}
+
+/**
+ * Places a timer in the wheel slot matching its expiry
+ * @param timer - timer to arm (timer->expires must be set)
+ */
+static void timer_arm(timer_t *timer) {
+    int expires = timer->expires;
+    int delta = expires - wheel_ticks;
+    int level;
+
+    if(delta < 0) {
+        // Already due; process on the next wheel tick
+        timer_link(&timer_wheel[0][TIMER_WHEEL_INDEX(wheel_ticks, 0)], timer);
+        return;
+    }
+
+    if(delta > TIMER_WHEEL_MAX) {
+        // Beyond the range of the wheel; re-evaluated on cascade
+        expires = wheel_ticks + TIMER_WHEEL_MAX;
+        delta = TIMER_WHEEL_MAX;
+    }
+
+    for(level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if(delta < (1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+    timer_link(&timer_wheel[level][TIMER_WHEEL_INDEX(expires, level)], timer);
+}
+
+/**
+ * Moves the timers of one slot in a wheel level down to the lower levels
+ * @param level - wheel level (1 or higher)
+ * @return index of the slot that was cascaded
+ */
+static int timer_cascade(int level) {
+    int index = TIMER_WHEEL_INDEX(wheel_ticks, level);
+    timer_t *timer;
+
+    while((timer = timer_wheel[level][index]) != NULL) {
+        timer_unlink(timer);
+        timer_arm(timer);
+    }
+    return index;
+}
+
+/**
+ * Programs channel 0 of the PIT
+ * @param cmd - PIT mode command
+ * @param count - counter value
+ */
+static void pit_program(int cmd, int count) {
+    outportb(PIT_CMD, cmd);
+    outportb(PIT_CH0_DATA, count & 0xff);
+    outportb(PIT_CH0_DATA, (count >> 8) & 0xff);
+}
+
+/**
+ * Reads the current counter value of channel 0 of the PIT
+ * @return counter value
+ */
+static int pit_read(void) {
+    int count;
+    outportb(PIT_CMD, PIT_CMD_LATCH);
+    count = inportb(PIT_CH0_DATA);
+    count |= inportb(PIT_CH0_DATA) << 8;
+    return count;
+}
 
 
 /**
@@ -50,15 +230,22 @@ queue_t timer_allocator;
 void timer_init(void) {
     kernel_log_info("Initializing Timer");
     timer_ticks = 0;
-    memset(timers, 0, sizeof(timer_t));
-    queue_init(&timer_allocator);
-    for(int i = 0; i < TIMERS_MAX; i++){
-        if(queue_in(&timer_allocator, i) == -1){
-            kernel_log_error("Error on timer queue allocation");
-            break;
-        }
+    memset(timers, 0, sizeof(timers));
+    memset(timer_wheel, 0, sizeof(timer_wheel));
+    wheel_ticks = 1;
+    timer_expired = NULL;
+
+    // Chain all of the timers into the free list
+    timer_free = NULL;
+    for(int i = TIMERS_MAX - 1; i >= 0; i--){
+        timers[i].next = timer_free;
+        timer_free = &timers[i];
     }
 
+    tickless_ticks = 0;
+    tickless_remainder = 0;
+    pit_program(PIT_CMD_PERIODIC, PIT_DIVISOR);
+
     interrupts_irq_register(IRQ_TIMER, isr_entry_timer, timer_irq_handler);
 }
 
@@ -67,19 +254,79 @@ void timer_init(void) {
  * @param func_ptr - function pointer to be called
  * @param interval - number of ticks before the callback is performed
  * @param repeat   - Indicate how many intervals to repeat (-1 should repeat forever)
+ * @param slack    - number of ticks the callback may be delayed by so that it
+ *                   can be batched with other timers (0 for none)
+ *
+ * @return the allocated timer id or -1 for errors
+ */
+int timer_callback_register(void (*func_ptr)(), int interval, int repeat, int slack) {
+    timer_t *timer = timer_free;
+
+    if(!func_ptr || interval <= 0 || slack < 0){
+        kernel_log_error("Invalid timer callback!");
+        return -1;
+    }
+    if(!timer){
+        kernel_log_error("Unable to register timer callback!");
+        return -1;
+    }
+    timer_free = timer->next;
+
+    timer->callback = func_ptr;
+    timer->arg = NULL;
+    timer->interval = interval;
+    timer->repeat = repeat;
+    timer->flags = 0;
+    timer->slack = slack;
+    timer->next = NULL;
+
+    // The first interval counts from now
+    timer->due = timer_ticks + interval;
+    timer->expires = timer_apply_slack(timer->due, slack);
+    timer_arm(timer);
+    return timer - timers;
+}
+
+/**
+ * Registers a new callback that is passed an argument
+ * The callback always runs in the timer IRQ (TIMER_FLAG_IRQ)
+ * @param func_ptr - function pointer to be called
+ * @param arg      - argument passed to the function
+ * @param interval - number of ticks before the callback is performed
+ * @param repeat   - Indicate how many intervals to repeat (-1 should repeat forever)
+ * @param slack    - number of ticks the callback may be delayed by so that it
+ *                   can be batched with other timers (0 for none)
  *
  * @return the allocated timer id or -1 for errors
  */
-int timer_callback_register(void (*func_ptr)(), int interval, int repeat) {
-    int timer_id = -1;
-    if(queue_out(&timer_allocator, &timer_id) == -1){
-        kernel_log_error("Unable to unregister timer callback!");
+int timer_callback_register_arg(void (*func_ptr)(void *), void *arg, int interval, int repeat, int slack) {
+    int id = timer_callback_register(func_ptr, interval, repeat, slack);
+
+    if(id != -1){
+        // The work queue only runs functions without arguments
+        timers[id].arg = arg;
+        timers[id].flags = TIMER_FLAG_ARG | TIMER_FLAG_IRQ;
+    }
+    return id;
+}
+
+/**
+ * Sets the flags for a registered callback
+ * @param id - timer id
+ * @param flags - TIMER_FLAG_* values
+ *
+ * @return 0 on success, -1 on error
+ */
+int timer_callback_set_flags(int id, int flags) {
+    if(id < 0 || id >= TIMERS_MAX || !timers[id].callback){
+        kernel_log_error("Invalid timer ID!");
         return -1;
     }
-    timers[timer_id].callback = func_ptr;
-    timers[timer_id].interval = interval;
-    timers[timer_id].repeat = repeat;
-    return timer_id;
+    if(timers[id].flags & TIMER_FLAG_ARG){
+        flags |= TIMER_FLAG_ARG | TIMER_FLAG_IRQ;
+    }
+    timers[id].flags = flags;
+    return 0;
 }
 
 /**
@@ -93,13 +340,19 @@ int timer_callback_unregister(int id) {
         kernel_log_error("Timer ID out of bounds!");
         return -1;
     }
+    if(!timers[id].callback){
+        kernel_log_error("Timer ID not registered!");
+        return -1;
+    }
+    timer_unlink(&timers[id]);
     timers[id].callback = NULL;
+    timers[id].arg = NULL;
     timers[id].interval = 0;
     timers[id].repeat = 0;
-    if(queue_in(&timer_allocator, id) == -1){
-        kernel_log_error("Unable to queue timer id!");
-        return -1;
-    }
+    timers[id].flags = 0;
+    timers[id].slack = 0;
+    timers[id].next = timer_free;
+    timer_free = &timers[id];
     return 0;
 }
 
@@ -112,25 +365,169 @@ int timer_get_system_time() {
     return timer_ticks;
 }
 
+/**
+ * Converts a time in milliseconds to timer ticks, rounding up
+ *
+ * The whole seconds are converted separately, so the result does not
+ * overflow for any non-negative number of milliseconds.
+ *
+ * @param ms - milliseconds (not negative)
+ * @return number of ticks
+ */
+int timer_ms_to_ticks(int ms) {
+    return ms / 1000 * TIMER_HZ + (ms % 1000 * TIMER_HZ + 999) / 1000;
+}
+
+/**
+ * Stops the periodic tick until the next non-deferrable timer is due
+ *
+ * Called when the idle task is about to run. The timer is programmed
+ * in one-shot mode for the next deadline (limited by the timer hardware).
+ */
+void timer_tickless_enter(void) {
+    int ticks = TIMER_TICKLESS_MAX;
+
+    if(!TIMER_TICKLESS || tickless_ticks) {
+        return;
+    }
+
+    // Find the number of ticks until the next timer that must not be delayed.
+    // Only the first wheel level needs to be checked: the PIT cannot be
+    // programmed further out than a level covers, and the tickless period
+    // ends at the next cascade in case it brings a timer down.
+    for(int i = 0; i < TIMER_TICKLESS_MAX - 1; i++){
+        int tick = wheel_ticks + i;
+        int index = TIMER_WHEEL_INDEX(tick, 0);
+        int due = (i > 0 && index == 0);
+
+        for(timer_t *timer = timer_wheel[0][index]; timer && !due; timer = timer->next){
+            due = !(timer->flags & TIMER_FLAG_DEFERRABLE);
+        }
+        if(due){
+            ticks = tick - timer_ticks;
+            break;
+        }
+    }
+
+    // Nothing to gain if a timer is due on the next tick anyway
+    if(ticks <= 1){
+        return;
+    }
+
+    tickless_ticks = ticks;
+    pit_program(PIT_CMD_ONESHOT, ticks * PIT_DIVISOR);
+}
+
+/**
+ * Restarts the periodic tick after a tickless period
+ *
+ * Catches up the system time for the ticks that were skipped. Must be
+ * called on every kernel entry before the interrupt is handled.
+ * @param irq - interrupt that caused the kernel entry
+ */
+void timer_tickless_exit(int irq) {
+    int elapsed;
+
+    if(!tickless_ticks){
+        return;
+    }
+
+    if(irq == IRQ_TIMER){
+        // The one-shot expired; the timer IRQ handler counts the last tick
+        timer_ticks += tickless_ticks - 1;
+    } else {
+        // Woken early; account the counts that elapsed so far
+        elapsed = tickless_ticks * PIT_DIVISOR - pit_read();
+        if(elapsed < 0 || elapsed >= tickless_ticks * PIT_DIVISOR){
+            // The one-shot already expired and its IRQ is pending
+            timer_ticks += tickless_ticks - 1;
+        } else {
+            elapsed += tickless_remainder;
+            timer_ticks += elapsed / PIT_DIVISOR;
+            tickless_remainder = elapsed % PIT_DIVISOR;
+        }
+    }
+
+    tickless_ticks = 0;
+    pit_program(PIT_CMD_PERIODIC, PIT_DIVISOR);
+    clock_page_update();
+}
+
+/**
+ * Runs the callbacks of all expired timers and re-arms repeating timers
+ */
+static void timer_run_expired(void) {
+    timer_t *timer;
+
+    while((timer = timer_expired) != NULL){
+        timer_unlink(timer);
+        if(timer->flags & TIMER_FLAG_ARG){
+            timer->callback(timer->arg);
+        } else if(timer->flags & TIMER_FLAG_IRQ){
+            timer->callback();
+        } else {
+            workqueue_add(timer->callback);
+        }
+
+        // Skip timers that the callback unregistered or re-armed itself
+        if(!timer->callback || timer->bucket){
+            continue;
+        }
+
+        if(timer->repeat == 0){
+            timer_callback_unregister(timer - timers);
+            continue;
+        }
+        if(timer->repeat > 0){
+            timer->repeat--;
+        }
+
+        // Keep the phase of the timer (slack does not accumulate); a
+        // deferrable timer that fell behind while the tick was stopped
+        // skips the intervals it missed
+        timer->due += timer->interval;
+        if((timer->flags & TIMER_FLAG_DEFERRABLE) && timer->due <= timer_ticks){
+            timer->due += ((timer_ticks - timer->due) / timer->interval + 1) * timer->interval;
+        }
+        timer->expires = timer_apply_slack(timer->due, timer->slack);
+        timer_arm(timer);
+    }
+}
+
 /**
  * Timer IRQ Handler
  *
  * Should perform the following:
  *   - Increment the timer ticks every time the timer occurs
- *   - Handle each registered timer
- *     - If the interval is hit, run the callback function
+ *   - Publish the tick count in the shared time page
+ *   - Advance the timing wheel to the current tick
+ *     - Cascade timers down from the higher levels when a level wraps
+ *     - Run the callback function of each timer in the current slot
  *     - Handle timer repeats
  */
 void timer_irq_handler(void) {
+    timer_t *timer;
+    int index;
+
     timer_ticks++;
-    for(int i = 0; i < TIMERS_MAX; i++){
-        if(timers[i].callback != NULL && timer_ticks % timers[i].interval == 0){
-            timers[i].callback();
-            if(timers[i].repeat > 0){
-                timers[i].repeat--;
-            }else if(timers[i].repeat == 0){
-                timer_callback_unregister(i);
-            }
+    clock_page_update();
+
+    // Normally a single tick; more after a tickless period
+    while(wheel_ticks <= timer_ticks){
+        index = TIMER_WHEEL_INDEX(wheel_ticks, 0);
+
+        // When the first level wraps, pull the next slot of each higher
+        // level down (continuing upward while those wrap as well)
+        if(index == 0){
+            for(int level = 1; level < TIMER_WHEEL_LEVELS && timer_cascade(level) == 0; level++);
+        }
+
+        while((timer = timer_wheel[0][index]) != NULL){
+            timer_unlink(timer);
+            timer_link(&timer_expired, timer);
         }
+
+        wheel_ticks++;
+        timer_run_expired();
     }
 }
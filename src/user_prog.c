@@ -5,18 +5,230 @@
  *
  * User "programs"
  */
-
 #include "user_prog.h"
-#include "vga.h"
+#include "user_syscall.h"
+
+// The user sections are mapped for ring 3 access page by page, so they
+// must not share a page with the rest of the kernel image. Aligning
+// the end of each section to a page (in a subsection after everything
+// the compiler emits) also raises the section alignment to a page, so
+// both ends land on page boundaries; paging_init() checks the result
+asm(".pushsection user_text, \"ax\", @progbits\n"
+    ".subsection 1\n"
+    ".balign 4096\n"
+    ".popsection\n"
+    ".pushsection user_rodata, \"a\", @progbits\n"
+    ".subsection 1\n"
+    ".balign 4096\n"
+    ".popsection");
+
+static const char user_test_msg[] USER_RODATA = "Test process is running...\n";
+static const char user_short_msg[] USER_RODATA = "Short process ran\n";
+static const char user_bench_int[] USER_RODATA = "int 0x80: ";
+static const char user_bench_sysenter[] USER_RODATA = "sysenter: ";
+static const char user_bench_unit[] USER_RODATA = " cycles/call\n";
+static const char user_bench_clock[] USER_RODATA = "time page: ";
+static const char user_bench_mutex[] USER_RODATA = "mutex: ";
+static const char user_ring_msg[] USER_RODATA = "ring: batched write\n";
+static const char user_ring_done[] USER_RODATA = "ring: completions ";
+static const char user_ring_timer[] USER_RODATA = "ring: timer expired\n";
+static const char user_newline[] USER_RODATA = "\n";
+static const char user_ipc_msg[] USER_RODATA = "ipc: page moved to the server and back\n";
+static const char user_ipc_bench[] USER_RODATA = "ipc call: ";
+
+/**
+ * Return address of every user program
+ * Ends the process with the exit system call
+ */
+USER_TEXT void user_exit(void) {
+    while(1) {
+        sys_exit();
+    }
+}
+
+/**
+ * Writes a number in decimal
+ * @param n - number
+ */
+USER_TEXT static void user_write_uint(unsigned int n) {
+    char buf[10];
+    int i = sizeof(buf);
+
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while(n && i > 0);
+    sys_write(&buf[i], sizeof(buf) - i);
+}
 
 /**
  * User test program
  * This "program" will test functionality that
  * our operating system provides
  */
-void user_test(void) {
-    vga_puts("Test process is running...\n");
+USER_TEXT void user_test(void) {
+    sys_write(user_test_msg, sizeof(user_test_msg) - 1);
+    while(1) {
+        sys_sleep(1000);
+    }
+}
+
+/**
+ * Short-lived user program
+ * Returns right away, exercising process exit and reaping
+ */
+USER_TEXT void user_short(void) {
+    sys_write(user_short_msg, sizeof(user_short_msg) - 1);
+}
+
+/**
+ * System call benchmark
+ * Measures the average round trip cost of a system call that does
+ * no work (getpid), through int and through sysenter, and the cost of
+ * reading the clock from the shared time page and of an uncontended
+ * user space mutex lock/unlock
+ */
+USER_TEXT void user_syscall_bench(void) {
+    unsigned long long start;
+    unsigned int int_cycles;
+    unsigned int fast_cycles;
+    unsigned int clock_cycles;
+    unsigned int mutex_cycles;
+    user_mutex_t mutex = { 0 };
+
+    // Warm up the caches and TLB before measuring
+    for(int i = 0; i < USER_BENCH_CALLS / 10; i++) {
+        syscall(SYSCALL_GETPID, 0, 0, 0);
+        sys_getpid();
+    }
+
+    // The totals stay well below 2^32 cycles
+    start = sys_cycles();
+    for(int i = 0; i < USER_BENCH_CALLS; i++) {
+        syscall(SYSCALL_GETPID, 0, 0, 0);
+    }
+    int_cycles = (unsigned int)(sys_cycles() - start) / USER_BENCH_CALLS;
+
+    start = sys_cycles();
+    for(int i = 0; i < USER_BENCH_CALLS; i++) {
+        sys_getpid();
+    }
+    fast_cycles = (unsigned int)(sys_cycles() - start) / USER_BENCH_CALLS;
+
+    start = sys_cycles();
+    for(int i = 0; i < USER_BENCH_CALLS; i++) {
+        sys_clock_ns();
+    }
+    clock_cycles = (unsigned int)(sys_cycles() - start) / USER_BENCH_CALLS;
+
+    start = sys_cycles();
+    for(int i = 0; i < USER_BENCH_CALLS; i++) {
+        user_mutex_lock(&mutex);
+        user_mutex_unlock(&mutex);
+    }
+    mutex_cycles = (unsigned int)(sys_cycles() - start) / USER_BENCH_CALLS;
+
+    sys_write(user_bench_int, sizeof(user_bench_int) - 1);
+    user_write_uint(int_cycles);
+    sys_write(user_bench_unit, sizeof(user_bench_unit) - 1);
+    sys_write(user_bench_sysenter, sizeof(user_bench_sysenter) - 1);
+    user_write_uint(fast_cycles);
+    sys_write(user_bench_unit, sizeof(user_bench_unit) - 1);
+    sys_write(user_bench_clock, sizeof(user_bench_clock) - 1);
+    user_write_uint(clock_cycles);
+    sys_write(user_bench_unit, sizeof(user_bench_unit) - 1);
+    sys_write(user_bench_mutex, sizeof(user_bench_mutex) - 1);
+    user_write_uint(mutex_cycles);
+    sys_write(user_bench_unit, sizeof(user_bench_unit) - 1);
+}
+
+/**
+ * System call ring test
+ * Queues a batch of console writes and a timer in the shared ring,
+ * rings the doorbell once and waits for the timer to expire
+ */
+USER_TEXT void user_ring_test(void) {
+    syscall_ring_t *ring = sys_ring_setup();
+    syscall_cqe_t cqe;
+    int completions = 0;
+
+    if(!ring) {
+        return;
+    }
+    for(int i = 0; i < USER_RING_WRITES; i++) {
+        user_ring_submit(ring, SYSCALL_WRITE, SYSCALL_FD_STDOUT,
+                         (unsigned int)user_ring_msg, sizeof(user_ring_msg) - 1, i);
+    }
+    user_ring_submit(ring, SYSCALL_TIMER, USER_RING_TIMER_MS, USER_RING_TIMER_DATA, 0, USER_RING_WRITES);
+    sys_ring_enter();
+
+    // The timer expiry is posted by the kernel on its own, after the
+    // completions of the requests
+    do {
+        while(user_ring_reap(ring, &cqe) == -1) {
+            sys_sleep(100);
+        }
+        completions++;
+    } while(cqe.user_data != USER_RING_TIMER_DATA);
+
+    sys_write(user_ring_timer, sizeof(user_ring_timer) - 1);
+    sys_write(user_ring_done, sizeof(user_ring_done) - 1);
+    user_write_uint(completions);
+    sys_write(user_newline, sizeof(user_newline) - 1);
+}
+
+/**
+ * IPC echo server
+ * Replies to every message with the first word incremented, sending
+ * back any page it received
+ */
+USER_TEXT void user_ipc_server(void) {
+    ipc_msg_t msg = { { 0 }, 0 };
+    int client;
+
     while(1) {
-        asm("hlt");
+        msg.page = IPC_AREA_ADDR;
+        client = sys_ipc_recv(&msg);
+        if(client == -1) {
+            continue;
+        }
+        msg.word[0]++;
+        sys_ipc_reply(client, &msg);
+    }
+}
+
+/**
+ * IPC client
+ * Times call/reply round trips with the echo server, then sends a
+ * page through it and prints what comes back
+ * @param server - process id of the echo server
+ */
+USER_TEXT USER_ENTRY_ARG void user_ipc_client(int server) {
+    char *buf = (char *)IPC_AREA_ADDR;
+    unsigned long long start;
+    ipc_msg_t msg = { { 0 }, 0 };
+
+    // Round trips with the message in registers
+    start = sys_cycles();
+    for(int i = 0; i < USER_IPC_CALLS; i++) {
+        msg.word[0] = i;
+        msg.page = 0;
+        if(sys_ipc_call(server, &msg) == -1 || msg.word[0] != (unsigned int)i + 1) {
+            return;
+        }
+    }
+    sys_write(user_ipc_bench, sizeof(user_ipc_bench) - 1);
+    user_write_uint((unsigned int)(sys_cycles() - start) / USER_IPC_CALLS);
+    sys_write(user_bench_unit, sizeof(user_bench_unit) - 1);
+
+    // Fill a page of the IPC area (mapped on first touch) and send it
+    // through the server; it comes back at the same address
+    for(unsigned int i = 0; i < sizeof(user_ipc_msg); i++) {
+        buf[i] = user_ipc_msg[i];
+    }
+    msg.page = IPC_AREA_ADDR;
+    if(sys_ipc_call(server, &msg) == -1 || msg.page != IPC_AREA_ADDR) {
+        return;
     }
+    sys_write(buf, sizeof(user_ipc_msg) - 1);
 }
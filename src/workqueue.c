@@ -0,0 +1,103 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ * Spring 2022
+ *
+ * Deferred work queue
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "interrupts.h"
+#include "kproc.h"
+#include "workqueue.h"
+#include "sync.h"
+
+// Pending work (circular queue of functions)
+void (*work_items[WORKQUEUE_SIZE])(void);
+int work_head;
+int work_tail;
+int work_size;
+
+// One unit per pending work item
+semaphore_t work_ready;
+
+// Kernel worker process
+proc_t *kworker;
+
+/**
+ * Kernel worker process
+ * Runs queued work with interrupts enabled and blocks when there is none
+ */
+void workqueue_worker(void) {
+    void (*func)(void);
+
+    while(1) {
+        semaphore_wait(&work_ready);
+
+        interrupts_disable();
+        func = work_items[work_head];
+        work_head = (work_head + 1) % WORKQUEUE_SIZE;
+        work_size--;
+        interrupts_enable();
+
+        func();
+    }
+}
+
+/**
+ * Initializes the work queue and starts the kernel worker process
+ * Must be called after the process table has been initialized
+ */
+void workqueue_init(void) {
+    int pid;
+
+    kernel_log_info("Initializing work queue");
+    memset(work_items, 0, sizeof(work_items));
+    work_head = 0;
+    work_tail = 0;
+    work_size = 0;
+    semaphore_init(&work_ready, 0);
+
+    // The worker runs at the default priority: deferred work (such as
+    // the process display) must not preempt every process on each tick
+    pid = kproc_create(workqueue_worker, "kworker", PROC_TYPE_KERNEL, 0);
+    kworker = pid_to_proc(pid);
+    if(!kworker) {
+        kernel_panic("Unable to start the kernel worker!");
+    }
+}
+
+/**
+ * Queues a function to be run by the kernel worker process
+ *
+ * Must be called with interrupts disabled (e.g. from interrupt context);
+ * the function runs later in process context with interrupts enabled.
+ * A function that is already pending is not queued again.
+ * @param func - function to run
+ * @return 0 on success, -1 on error
+ */
+int workqueue_add(void (*func)(void)) {
+    if(!func) {
+        kernel_log_error("Invalid work item!");
+        return -1;
+    }
+    // Repeating timers fire every interval while the worker waits for
+    // the CPU; one pending run covers them all
+    for(int i = 0, j = work_head; i < work_size; i++, j = (j + 1) % WORKQUEUE_SIZE) {
+        if(work_items[j] == func) {
+            return 0;
+        }
+    }
+    if(work_size == WORKQUEUE_SIZE) {
+        kernel_log_warn("Work queue full!");
+        return -1;
+    }
+
+    work_items[work_tail] = func;
+    work_tail = (work_tail + 1) % WORKQUEUE_SIZE;
+    work_size++;
+
+    semaphore_post(&work_ready);
+    return 0;
+}